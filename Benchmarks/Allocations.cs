@@ -0,0 +1,69 @@
+﻿using BenchmarkDotNet.Attributes;
+using Circuit;
+using System;
+using System.Collections.Generic;
+
+namespace Benchmarks
+{
+    /// <summary>
+    /// Garbage produced by Simulation.Run once the process function is built. Collections on the
+    /// audio thread cause dropouts, so every benchmark here should allocate 0 bytes.
+    /// </summary>
+    [MemoryDiagnoser]
+    public class Allocations
+    {
+        private const int SampleRate = 48000;
+        private const int Samples = 256;
+
+        [Params("Ibanez Tube Screamer TS-9", "Marshall JCM800 2203 Preamp")]
+        public string Example { get; set; }
+
+        [Params(Circuit.Resampling.Linear, Circuit.Resampling.Polyphase)]
+        public Resampling Resampling { get; set; }
+
+        private Simulation simulation;
+        private double[] input = new double[Samples];
+        private double[] output = new double[Samples];
+        private double[][] inputs, outputs;
+        private List<double[]> inputList, outputList;
+
+        [GlobalSetup]
+        public void Setup()
+        {
+            simulation = Simulations.Load(Example, SampleRate, 8);
+            simulation.Resampling = Resampling;
+
+            for (int n = 0; n < Samples; ++n)
+                input[n] = 0.25 * Math.Sin(2 * Math.PI * 82 * n / SampleRate);
+            inputs = new[] { input };
+            outputs = new[] { output };
+            inputList = new List<double[]> { input };
+            outputList = new List<double[]> { output };
+
+            // Build the process function and the resampling buffers outside of the measurement.
+            simulation.Run(Samples, inputs, outputs);
+            simulation.Run(Samples, inputList, outputList);
+            simulation.Run(input, output);
+        }
+
+        // The host's buffers, as the VST passes them.
+        [Benchmark(Baseline = true)]
+        public void Arrays()
+        {
+            simulation.Run(Samples, inputs, outputs);
+        }
+
+        // Buffers collected into lists, as LiveSPICE does for its probes.
+        [Benchmark]
+        public void Lists()
+        {
+            simulation.Run(Samples, inputList, outputList);
+        }
+
+        [Benchmark]
+        public void SingleBuffers()
+        {
+            simulation.Run(input, output);
+        }
+    }
+}
@@ -0,0 +1,53 @@
+﻿using BenchmarkDotNet.Attributes;
+using Circuit;
+using System;
+
+namespace Benchmarks
+{
+    /// <summary>
+    /// Cost of a block of silence after a transient. The state decays towards zero and, unless it
+    /// is flushed, spends a long time in the sub-normal range where arithmetic is many times
+    /// slower. The time per block should not depend on how long the circuit has been silent.
+    /// </summary>
+    public class Denormals
+    {
+        private const int SampleRate = 48000;
+        private const int Samples = 4800;
+
+        [Params(8)]
+        public int Oversample { get; set; }
+
+        [Params("Passive 1stOrder Lowpass RC", "Ibanez Tube Screamer TS-9", "Marshall Blues Breaker")]
+        public string Example { get; set; }
+
+        // Seconds of silence before the measured blocks.
+        [Params(0, 1, 10)]
+        public int Silence { get; set; }
+
+        private Simulation simulation;
+        private double[] input = new double[Samples];
+        private double[][] output;
+
+        [GlobalSetup]
+        public void Setup()
+        {
+            simulation = Simulations.Load(Example, SampleRate, Oversample);
+            output = new[] { new double[Samples] };
+
+            // A loud decaying burst, then silence until the measurement starts.
+            for (int n = 0; n < Samples; ++n)
+                input[n] = Math.Exp(-n * 1e-3) * Math.Sin(2 * Math.PI * 110 * n / SampleRate);
+            simulation.Run(input, output);
+
+            Array.Clear(input, 0, Samples);
+            for (int i = 0; i < Silence * SampleRate / Samples; ++i)
+                simulation.Run(input, output);
+        }
+
+        [Benchmark]
+        public void Run()
+        {
+            simulation.Run(input, output);
+        }
+    }
+}
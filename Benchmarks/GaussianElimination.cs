@@ -14,7 +14,7 @@ namespace Benchmarks
         HardwareCounter.CacheMisses)]
     public class GaussianElimination
     {
-        [Params(12)]
+        [Params(2, 4, 8, 12)]
         public int M { get; set; }
         public int N => M;
         public int Size => 100000;
@@ -22,7 +22,10 @@ public class GaussianElimination
         private const int seed = 12345;
 
 
-        private (double[] RowMajorArray, double[] ColumnMajorArray, double[][] JaggedArray, Matrix<double> A, Vector<double> b)[] _data;
+        private (double[] RowMajorArray, double[] ColumnMajorArray, double[][] JaggedArray, double[] FlatArray, Matrix<double> A, Vector<double> b)[] _data;
+
+        // The layout of Simulation's Newton matrix: column-major with padded columns, and a scratch column.
+        private int Stride => Simulation.SolveStride(M);
 
         [IterationSetup]
         public void Setup()
@@ -39,6 +42,7 @@ public void Setup()
                 return (RowMajorArray: ab.ToRowMajorArray(),
                         ColumnMajorArray: ab.ToColumnMajorArray(),
                         JaggedArray: ab.ToRowArrays().Select(a => a.Concat(Enumerable.Repeat(0d, System.Numerics.Vector<double>.Count)).ToArray()).ToArray(),
+                        FlatArray: ab.ToColumnArrays().Append(new double[M]).SelectMany(c => c.Concat(Enumerable.Repeat(0d, Stride - M))).ToArray(),
                         A: A,
                         b: b);
 
@@ -159,6 +163,20 @@ public void Current()
             }
         }
 
+        [Benchmark]
+        public void FlatColumnMajor()
+        {
+            for (int iteration = 0; iteration < Size; iteration++)
+                Simulation.SolveColumnMajor(_data[iteration].FlatArray, M, N + 1, Stride);
+        }
+
+        [Benchmark]
+        public void FlatColumnMajorVectorized()
+        {
+            for (int iteration = 0; iteration < Size; iteration++)
+                Simulation.SolveColumnMajorVector(_data[iteration].FlatArray, M, N + 1, Stride);
+        }
+
         [Benchmark]
         public void ArrayOfArrays()
         {
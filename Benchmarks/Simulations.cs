@@ -0,0 +1,89 @@
+﻿using BenchmarkDotNet.Attributes;
+using Circuit;
+using ComputerAlgebra;
+using System;
+using System.Collections.Generic;
+using System.IO;
+using System.Linq;
+
+namespace Benchmarks
+{
+    /// <summary>
+    /// Simulation.Run end to end on the example circuits, so changes to the generated process
+    /// function (such as the layout of the Newton matrix) are measured on real solver shapes.
+    /// </summary>
+    [MemoryDiagnoser]
+    public class Simulations
+    {
+        private const int SampleRate = 48000;
+        private const int Samples = 4800;
+
+        [Params(8)]
+        public int Oversample { get; set; }
+
+        [ParamsSource(nameof(Examples))]
+        public string Example { get; set; }
+
+        public static IEnumerable<string> Examples => Directory.GetFiles(ExamplesDirectory, "*.schx").Select(Path.GetFileNameWithoutExtension).OrderBy(i => i);
+
+        // Tests/Examples, found from the directory the benchmark runs in.
+        internal static string ExamplesDirectory
+        {
+            get
+            {
+                for (DirectoryInfo dir = new DirectoryInfo(AppContext.BaseDirectory); dir != null; dir = dir.Parent)
+                {
+                    string examples = Path.Combine(dir.FullName, "Tests", "Examples");
+                    if (Directory.Exists(examples))
+                        return examples;
+                }
+                throw new DirectoryNotFoundException("Tests/Examples");
+            }
+        }
+
+        private Simulation simulation;
+        private double[] input = new double[Samples];
+        private double[][] output;
+
+        // Same input and output as the Tests benchmark: the first input, and the sum of the speakers.
+        internal static Simulation Load(string example, int sampleRate, int oversample)
+        {
+            Circuit.Circuit circuit = Schematic.Load(Path.Combine(ExamplesDirectory, example + ".schx")).Build();
+            TransientSolution solution = TransientSolution.Solve(circuit.Analyze(), (Real)1 / (sampleRate * oversample));
+
+            Expression speakers = 0;
+            foreach (Speaker i in circuit.Components.OfType<Speaker>())
+                speakers += i.Out;
+            return new Simulation(solution)
+            {
+                Oversample = oversample,
+                Iterations = 8,
+                Input = circuit.Components.OfType<Input>().Select(i => i.In).DefaultIfEmpty("V[t]").Take(1).ToArray(),
+                Output = new[] { speakers },
+            };
+        }
+
+        [GlobalSetup]
+        public void Setup()
+        {
+            simulation = Load(Example, SampleRate, Oversample);
+            output = new[] { new double[Samples] };
+
+            // A few harmonics of a low E string.
+            for (int n = 0; n < Samples; ++n)
+            {
+                double t = (double)n / SampleRate;
+                input[n] = 0.25 * (Math.Sin(2 * Math.PI * 82 * t) + Math.Sin(2 * Math.PI * 164 * t));
+            }
+
+            // Compile the process function outside of the measurement.
+            simulation.Run(input, output);
+        }
+
+        [Benchmark]
+        public void Run()
+        {
+            simulation.Run(input, output);
+        }
+    }
+}
@@ -0,0 +1,39 @@
+﻿using BenchmarkDotNet.Attributes;
+using Circuit;
+using ComputerAlgebra;
+using System.IO;
+using Util;
+
+namespace Benchmarks
+{
+    /// <summary>
+    /// Time to solve a circuit symbolically, with the independent systems solved one at a time and
+    /// in parallel. Both give the same solution.
+    /// </summary>
+    public class SymbolicAnalysis
+    {
+        private const int SampleRate = 48000;
+        private const int Oversample = 8;
+
+        [Params("Ibanez Tube Screamer TS-9", "Marshall JCM800 2203 Preamp", "Marshall JCM2000 DSL Preamp")]
+        public string Example { get; set; }
+
+        // 1 solves the systems in sequence, -1 uses all cores.
+        [Params(1, -1)]
+        public int MaxDegreeOfParallelism { get; set; }
+
+        private Circuit.Circuit circuit;
+
+        [GlobalSetup]
+        public void Setup()
+        {
+            circuit = Schematic.Load(Path.Combine(Simulations.ExamplesDirectory, Example + ".schx")).Build();
+        }
+
+        [Benchmark]
+        public TransientSolution Solve()
+        {
+            return TransientSolution.Solve(circuit.Analyze(), (Real)1 / (SampleRate * Oversample), new Arrow[] { }, new NullLog(), true, MaxDegreeOfParallelism);
+        }
+    }
+}
@@ -2,6 +2,7 @@
 using System;
 using System.Collections.Generic;
 using System.Linq;
+using System.Text;
 
 namespace Circuit
 {
@@ -13,6 +14,37 @@ public class AnalysisException : Exception
         public AnalysisException(string Message) : base(Message) { }
     }
 
+    /// <summary>
+    /// A variable of the system that can change while a simulation runs without solving the system
+    /// again, such as the position of a potentiometer.
+    /// </summary>
+    public class Parameter
+    {
+        private string name;
+        /// <summary>
+        /// Name of the parameter, the path of the component it belongs to and the property, such as
+        /// "Drive Pot.Wipe".
+        /// </summary>
+        public string Name { get { return name; } }
+
+        private Variable variable;
+        /// <summary>
+        /// The variable representing this parameter in the system. Its name is the name of the parameter
+        /// made into an identifier, so the expressions of a solution can be parsed back from text.
+        /// </summary>
+        public Variable Variable { get { return variable; } }
+
+        private Func<double> value;
+        /// <summary>
+        /// The current value of the parameter.
+        /// </summary>
+        public double Value { get { return value(); } }
+
+        public Parameter(string Name, Variable Variable, Func<double> Value) { name = Name; variable = Variable; value = Value; }
+
+        public override string ToString() { return variable.ToString(); }
+    }
+
     /// <summary>
     /// Helper class for building a system of MNA equations and unknowns.
     /// </summary>
@@ -22,6 +54,17 @@ public class Analysis : DynamicNamespace
         private List<Expression> unknowns = new List<Expression>();
         private Dictionary<Expression, Expression> kcl = new Dictionary<Expression, Expression>();
         private List<Arrow> initialConditions = new List<Arrow>();
+        private List<Parameter> parameters = new List<Parameter>();
+
+        private bool parametric = false;
+        /// <summary>
+        /// If true, parameters added by components are variables of the system, so the solution
+        /// remains valid when their values change. Otherwise, they are substituted by their current values.
+        /// </summary>
+        public bool Parametric { get { return parametric; } set { parametric = value; } }
+
+        public Analysis() { }
+        public Analysis(bool Parametric) { parametric = Parametric; }
 
         // Describes the analysis of a subcircuit.
         protected class Circuit
@@ -134,6 +177,11 @@ public void DeclNodes(IEnumerable<Node> Nodes)
         /// </summary>
         public IEnumerable<Arrow> InitialConditions { get { return initialConditions; } }
 
+        /// <summary>
+        /// Enumerates the parameters of the system.
+        /// </summary>
+        public IEnumerable<Parameter> Parameters { get { return parameters; } }
+
         /// <summary>
         /// Add a current to the given node.
         /// </summary>
@@ -240,6 +288,38 @@ public Expression AddUnknownEqualTo(string Name, Expression Eq)
         /// <returns></returns>
         public Expression AddUnknownEqualTo(Expression Eq) { return AddUnknownEqualTo(AnonymousName(), Eq); }
 
+        /// <summary>
+        /// Add a parameter to the system. If the analysis is not parametric, this is just the current value.
+        /// </summary>
+        /// <param name="Name"></param>
+        /// <param name="Value">Gets the current value of the parameter.</param>
+        /// <returns></returns>
+        public Expression AddParameter(string Name, Func<double> Value)
+        {
+            if (!parametric)
+                return Value();
+            string name = context.Prefix + Name;
+            Parameter x = new Parameter(name, Variable.New(ParameterIdentifier(name)), Value);
+            parameters.Add(x);
+            return x.Variable;
+        }
+
+        // Component names can contain anything, such as spaces. Replace the characters that can't be
+        // in an identifier, and number the identifiers that collide.
+        private string ParameterIdentifier(string Name)
+        {
+            StringBuilder id = new StringBuilder();
+            foreach (char i in Name)
+                id.Append(char.IsLetterOrDigit(i) || i == '_' || i == '.' ? i : '_');
+            if (id.Length == 0 || !(char.IsLetter(id[0]) || id[0] == '_'))
+                id.Insert(0, '_');
+
+            string unique = id.ToString();
+            for (int n = 2; parameters.Any(i => i.Variable.ToString() == unique); ++n)
+                unique = id.ToString() + "_" + n;
+            return unique;
+        }
+
         /// <summary>
         /// Add initial conditions to the system.
         /// </summary>
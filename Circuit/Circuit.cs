@@ -76,9 +76,16 @@ public override void Analyze(Analysis Mna)
             Mna.PopContext();
         }
 
-        public Analysis Analyze()
+        public Analysis Analyze() { return Analyze(false); }
+        /// <summary>
+        /// Analyze the circuit.
+        /// </summary>
+        /// <param name="Parametric">Analyze the controls (potentiometers) as parameters of the system, which can
+        /// change without solving the circuit again.</param>
+        /// <returns></returns>
+        public Analysis Analyze(bool Parametric)
         {
-            Analysis mna = new Analysis();
+            Analysis mna = new Analysis(Parametric);
             mna.PushContext(null, Nodes);
             foreach (Component c in Components)
                 c.Analyze(mna);
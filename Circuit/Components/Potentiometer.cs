@@ -63,7 +63,7 @@ public void ConnectTo(Node A, Node C, Node W)
 
         public override void Analyze(Analysis Mna)
         {
-            Expression P = VariableResistor.AdjustWipe(wipe, sweep);
+            Expression P = Mna.AddParameter(Name + ".Wipe", () => VariableResistor.AdjustWipe(wipe, sweep));
 
             Expression R1 = Resistance * P;
             Expression R2 = Resistance * (1 - P);
@@ -80,7 +80,7 @@ public class VariableResistor : TwoTerminal, IPotControl
 
         public override void Analyze(Analysis Mna)
         {
-            Expression P = AdjustWipe(wipe, sweep);
+            Expression P = Mna.AddParameter(Name + ".Wipe", () => AdjustWipe(wipe, sweep));
 
             Resistor.Analyze(Mna, Name, Anode, Cathode, (Expression)Resistance * P);
         }
@@ -0,0 +1,196 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Linq;
+using System.Reflection;
+using LinqExpr = System.Linq.Expressions.Expression;
+using MethodCallExpr = System.Linq.Expressions.MethodCallExpression;
+
+namespace Circuit
+{
+    /// <summary>
+    /// Table driven approximations of exp, log and pow for evaluating the nonlinear device models.
+    /// 
+    /// exp(x) = 2^(k/128)*e^r, where 2^(j/128) comes from a table and |r| <= ln(2)/256.
+    /// log(m*2^e) = e*ln(2) + log(c) + log(1 + (m - c)/c), where log(c) comes from a table and |(m - c)/c| <= 1/256.
+    /// The remaining e^r and log(1 + r) are evaluated with short Taylor polynomials.
+    /// 
+    /// Arguments outside of the range of normal results (including NaN/Infinity) are passed to System.Math.
+    /// </summary>
+    public static class FastMath
+    {
+        private const int TableBits = 7;
+        private const int TableSize = 1 << TableBits;
+        private const int TableMask = TableSize - 1;
+
+        // ln(2) split into a part with trailing zeros (so k*Ln2Hi is exact) and the rest.
+        private const double Ln2Hi = 6.93147180369123816490e-01;
+        private const double Ln2Lo = 1.90821492927058770002e-10;
+        private const double InvLn2 = TableSize / 0.693147180559945309417;
+
+        // Keep 2^(k >> TableBits) a normal double.
+        private const double MinExp = -708.0;
+        private const double MaxExp = 709.0;
+        private const double MinLog = 2.2250738585072014e-308;
+
+        // 2^(j/TableSize)
+        private static readonly double[] exp2 = Enumerable.Range(0, TableSize).Select(j => Math.Pow(2.0, (double)j / TableSize)).ToArray();
+        // c_j = 1 + (j + 0.5)/TableSize, log(c_j) and 1/c_j.
+        private static readonly double[] logc = Enumerable.Range(0, TableSize).Select(j => 1.0 + (j + 0.5) / TableSize).ToArray();
+        private static readonly double[] logLogc = logc.Select(c => Math.Log(c)).ToArray();
+        private static readonly double[] logInvc = logc.Select(c => 1.0 / c).ToArray();
+
+        private static double Pow2(int k)
+        {
+            return exp2[k & TableMask] * BitConverter.Int64BitsToDouble((long)((k >> TableBits) + 1023) << 52);
+        }
+
+        /// <summary>
+        /// exp(x) with a relative error less than 4e-9.
+        /// </summary>
+        public static double Exp2nd(double x)
+        {
+            if (!(x >= MinExp && x <= MaxExp))
+                return Math.Exp(x);
+            double k = Math.Round(x * InvLn2);
+            double r = (x - k * (Ln2Hi / TableSize)) - k * (Ln2Lo / TableSize);
+            return Pow2((int)k) * (1.0 + r * (1.0 + r * 0.5));
+        }
+
+        /// <summary>
+        /// exp(x) with a relative error less than 3e-12.
+        /// </summary>
+        public static double Exp3rd(double x)
+        {
+            if (!(x >= MinExp && x <= MaxExp))
+                return Math.Exp(x);
+            double k = Math.Round(x * InvLn2);
+            double r = (x - k * (Ln2Hi / TableSize)) - k * (Ln2Lo / TableSize);
+            return Pow2((int)k) * (1.0 + r * (1.0 + r * (0.5 + r * (1.0 / 6.0))));
+        }
+
+        /// <summary>
+        /// log(x) with an absolute error less than 6e-11.
+        /// </summary>
+        public static double Log3rd(double x)
+        {
+            if (!(x >= MinLog && x <= double.MaxValue))
+                return Math.Log(x);
+            long bits = BitConverter.DoubleToInt64Bits(x);
+            int e = (int)(bits >> 52) - 1023;
+            int j = (int)(bits >> (52 - TableBits)) & TableMask;
+            double m = BitConverter.Int64BitsToDouble((bits & 0x000FFFFFFFFFFFFFL) | 0x3FF0000000000000L);
+            double r = (m - logc[j]) * logInvc[j];
+            return e * Ln2Hi + (e * Ln2Lo + logLogc[j] + r * (1.0 + r * (-0.5 + r * (1.0 / 3.0))));
+        }
+
+        /// <summary>
+        /// log(x) with an absolute error less than 2e-13.
+        /// </summary>
+        public static double Log4th(double x)
+        {
+            if (!(x >= MinLog && x <= double.MaxValue))
+                return Math.Log(x);
+            long bits = BitConverter.DoubleToInt64Bits(x);
+            int e = (int)(bits >> 52) - 1023;
+            int j = (int)(bits >> (52 - TableBits)) & TableMask;
+            double m = BitConverter.Int64BitsToDouble((bits & 0x000FFFFFFFFFFFFFL) | 0x3FF0000000000000L);
+            double r = (m - logc[j]) * logInvc[j];
+            return e * Ln2Hi + (e * Ln2Lo + logLogc[j] + r * (1.0 + r * (-0.5 + r * (1.0 / 3.0 + r * -0.25))));
+        }
+
+        /// <summary>
+        /// x^y for x > 0, with a relative error less than 4e-9 + |y|*6e-11.
+        /// </summary>
+        public static double Pow2nd(double x, double y)
+        {
+            if (!(x > 0.0))
+                return Math.Pow(x, y);
+            return Exp2nd(y * Log3rd(x));
+        }
+
+        /// <summary>
+        /// x^y for x > 0, with a relative error less than 3e-12 + |y|*2e-13.
+        /// </summary>
+        public static double Pow3rd(double x, double y)
+        {
+            if (!(x > 0.0))
+                return Math.Pow(x, y);
+            return Exp3rd(y * Log4th(x));
+        }
+
+        // Approximations ordered from least to most accurate, with the largest relative error
+        // of exp and pow (|y| <= 2) for each.
+        private class Approximation
+        {
+            public double Error;
+            public MethodInfo Exp, Log, Pow;
+
+            public Approximation(double Error, string Exp, string Log, string Pow)
+            {
+                this.Error = Error;
+                this.Exp = typeof(FastMath).GetMethod(Exp);
+                this.Log = typeof(FastMath).GetMethod(Log);
+                this.Pow = typeof(FastMath).GetMethod(Pow);
+            }
+        }
+        private static readonly Approximation[] approximations = new[]
+        {
+            new Approximation(4e-9, nameof(Exp2nd), nameof(Log3rd), nameof(Pow2nd)),
+            new Approximation(3e-12, nameof(Exp3rd), nameof(Log4th), nameof(Pow3rd)),
+        };
+
+        /// <summary>
+        /// The smallest error bound that can be satisfied without using System.Math.
+        /// </summary>
+        public static double MinError { get { return approximations.Last().Error; } }
+
+        /// <summary>
+        /// Replace calls to System.Math.Exp/Log/Pow in a LINQ expression with the least accurate
+        /// approximation that meets the given error bound. If Error is less than MinError, the
+        /// expression is returned unchanged.
+        /// </summary>
+        /// <param name="Expr">Expression to rewrite.</param>
+        /// <param name="Error">Largest relative error allowed.</param>
+        /// <param name="Replaced">Number of calls that were replaced.</param>
+        public static T Approximate<T>(T Expr, double Error, out int Replaced) where T : LinqExpr
+        {
+            Approximation a = approximations.FirstOrDefault(i => i.Error <= Error);
+            if (a == null)
+            {
+                Replaced = 0;
+                return Expr;
+            }
+            ApproximateVisitor v = new ApproximateVisitor(a);
+            T result = (T)v.Visit(Expr);
+            Replaced = v.Replaced;
+            return result;
+        }
+
+        private class ApproximateVisitor : System.Linq.Expressions.ExpressionVisitor
+        {
+            private Dictionary<MethodInfo, MethodInfo> map;
+            public int Replaced = 0;
+
+            public ApproximateVisitor(Approximation A)
+            {
+                map = new Dictionary<MethodInfo, MethodInfo>()
+                {
+                    { typeof(Math).GetMethod(nameof(Math.Exp), new[] { typeof(double) }), A.Exp },
+                    { typeof(Math).GetMethod(nameof(Math.Log), new[] { typeof(double) }), A.Log },
+                    { typeof(Math).GetMethod(nameof(Math.Pow), new[] { typeof(double), typeof(double) }), A.Pow },
+                };
+            }
+
+            protected override LinqExpr VisitMethodCall(MethodCallExpr node)
+            {
+                node = (MethodCallExpr)base.VisitMethodCall(node);
+                if (node.Object == null && map.TryGetValue(node.Method, out MethodInfo f))
+                {
+                    Replaced++;
+                    return LinqExpr.Call(f, node.Arguments);
+                }
+                return node;
+            }
+        }
+    }
+}
@@ -0,0 +1,496 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Globalization;
+using System.Linq;
+using System.Linq.Expressions;
+using System.Reflection;
+using LinqExpr = System.Linq.Expressions.Expression;
+
+namespace Circuit
+{
+    /// <summary>
+    /// Number of arithmetic operations and function calls in an expression.
+    /// </summary>
+    public class OperationCount
+    {
+        public int Add, Multiply, Divide, Call;
+        /// <summary>
+        /// Calls to exp, log, pow and trigonometric functions, included in Call.
+        /// </summary>
+        public int Transcendental;
+
+        /// <summary>
+        /// Total number of operations.
+        /// </summary>
+        public int Total { get { return Add + Multiply + Divide + Call; } }
+
+        /// <summary>
+        /// Count the operations in an expression. Each node counts once, regardless of how many
+        /// times it executes.
+        /// </summary>
+        public static OperationCount Of(LinqExpr Expr)
+        {
+            Counter counter = new Counter();
+            counter.Visit(Expr);
+            return counter.Count;
+        }
+
+        public override string ToString() { return Total + " (" + Add + " add, " + Multiply + " mul, " + Divide + " div, " + Call + " call)"; }
+
+        private class Counter : ExpressionVisitor
+        {
+            public OperationCount Count = new OperationCount();
+
+            protected override LinqExpr VisitBinary(BinaryExpression node)
+            {
+                switch (node.NodeType)
+                {
+                    case ExpressionType.Add:
+                    case ExpressionType.AddAssign:
+                    case ExpressionType.Subtract:
+                    case ExpressionType.SubtractAssign:
+                        Count.Add++; break;
+                    case ExpressionType.Multiply:
+                    case ExpressionType.MultiplyAssign:
+                        Count.Multiply++; break;
+                    case ExpressionType.Divide:
+                    case ExpressionType.DivideAssign:
+                        Count.Divide++; break;
+                }
+                return base.VisitBinary(node);
+            }
+
+            protected override LinqExpr VisitUnary(UnaryExpression node)
+            {
+                if (node.NodeType == ExpressionType.Negate)
+                    Count.Add++;
+                return base.VisitUnary(node);
+            }
+
+            private static readonly HashSet<string> transcendental = new HashSet<string>()
+            {
+                "Exp", "Log", "Log10", "Pow", "Sin", "Cos", "Tan", "Asin", "Acos", "Atan", "Atan2", "Sinh", "Cosh", "Tanh",
+            };
+
+            protected override LinqExpr VisitMethodCall(MethodCallExpression node)
+            {
+                Count.Call++;
+                if (node.Method.DeclaringType == typeof(Math) && transcendental.Contains(node.Method.Name))
+                    Count.Transcendental++;
+                return base.VisitMethodCall(node);
+            }
+        }
+    }
+
+    /// <summary>
+    /// Optimizations of generated LINQ expressions, applied before compiling them:
+    /// 
+    /// - Divisions by constants become multiplications by the reciprocal, and Math.Pow with a small
+    ///   constant exponent becomes products/Math.Sqrt.
+    /// - Pure subexpressions that are evaluated more than once in a straight line sequence of
+    ///   statements (no labels, loops or branches between them) are evaluated once into a temporary.
+    ///   Commutative operations match regardless of operand order.
+    /// 
+    /// Pure subexpressions are floating point arithmetic, comparisons, conditionals and calls to
+    /// Math/FastMath of variables and constants. These can't throw, so they may be evaluated ahead of
+    /// a branch that only conditionally needs them.
+    /// </summary>
+    public static class LinqOptimizer
+    {
+        /// <summary>
+        /// Optimize an expression.
+        /// </summary>
+        /// <param name="Expr">Expression to optimize, usually a lambda.</param>
+        /// <returns>Optimized expression computing the same result.</returns>
+        public static T Optimize<T>(T Expr) where T : LinqExpr
+        {
+            LinqExpr result = new StrengthReduction().Visit(Expr);
+            result = new CommonSubexpressions().Visit(result);
+            return (T)result;
+        }
+
+        private static bool IsFloat(Type T) { return T == typeof(double) || T == typeof(float); }
+
+        private static bool IsPureMethod(MethodInfo Method)
+        {
+            return Method.IsStatic && (Method.DeclaringType == typeof(Math) || Method.DeclaringType == typeof(FastMath));
+        }
+
+        // Expressions that have no side effects and can't throw.
+        private static bool IsPure(LinqExpr x)
+        {
+            switch (x.NodeType)
+            {
+                case ExpressionType.Constant:
+                case ExpressionType.Parameter:
+                    return true;
+                case ExpressionType.Add:
+                case ExpressionType.Subtract:
+                case ExpressionType.Multiply:
+                case ExpressionType.Divide:
+                    BinaryExpression b = (BinaryExpression)x;
+                    return IsFloat(x.Type) && b.Method == null && IsPure(b.Left) && IsPure(b.Right);
+                case ExpressionType.LessThan:
+                case ExpressionType.LessThanOrEqual:
+                case ExpressionType.GreaterThan:
+                case ExpressionType.GreaterThanOrEqual:
+                case ExpressionType.Equal:
+                case ExpressionType.NotEqual:
+                case ExpressionType.AndAlso:
+                case ExpressionType.OrElse:
+                    BinaryExpression c = (BinaryExpression)x;
+                    return c.Method == null && IsPure(c.Left) && IsPure(c.Right);
+                case ExpressionType.Negate:
+                case ExpressionType.UnaryPlus:
+                    UnaryExpression u = (UnaryExpression)x;
+                    return IsFloat(x.Type) && u.Method == null && IsPure(u.Operand);
+                case ExpressionType.Convert:
+                    UnaryExpression cv = (UnaryExpression)x;
+                    return IsFloat(x.Type) && cv.Method == null && cv.Operand.Type.IsPrimitive && IsPure(cv.Operand);
+                case ExpressionType.Not:
+                    return x.Type == typeof(bool) && IsPure(((UnaryExpression)x).Operand);
+                case ExpressionType.Conditional:
+                    ConditionalExpression cond = (ConditionalExpression)x;
+                    return IsPure(cond.Test) && IsPure(cond.IfTrue) && IsPure(cond.IfFalse);
+                case ExpressionType.Call:
+                    MethodCallExpression call = (MethodCallExpression)x;
+                    return IsPureMethod(call.Method) && call.Arguments.All(IsPure);
+                default:
+                    return false;
+            }
+        }
+
+        private class StrengthReduction : ExpressionVisitor
+        {
+            protected override LinqExpr VisitBinary(BinaryExpression node)
+            {
+                node = (BinaryExpression)base.VisitBinary(node);
+                // x / c -> x * (1 / c)
+                if (node.NodeType == ExpressionType.Divide && node.Method == null && node.Type == typeof(double) && node.Right is ConstantExpression c)
+                {
+                    double inv = 1.0 / (double)c.Value;
+                    if (inv != 0.0 && !double.IsInfinity(inv) && !double.IsNaN(inv))
+                        return LinqExpr.Multiply(node.Left, LinqExpr.Constant(inv));
+                }
+                return node;
+            }
+
+            protected override LinqExpr VisitMethodCall(MethodCallExpression node)
+            {
+                node = (MethodCallExpression)base.VisitMethodCall(node);
+                if (node.Method.DeclaringType == typeof(Math) && node.Method.Name == nameof(Math.Pow) && node.Arguments[1] is ConstantExpression c)
+                {
+                    LinqExpr x = node.Arguments[0];
+                    double y = (double)c.Value;
+                    if (y == 1.0)
+                        return x;
+                    // The rest evaluate x more than once, which is fine because CSE shares it.
+                    if (!IsPure(x))
+                        return node;
+                    if (y == 2.0)
+                        return LinqExpr.Multiply(x, x);
+                    if (y == 3.0)
+                        return LinqExpr.Multiply(LinqExpr.Multiply(x, x), x);
+                    if (y == -1.0)
+                        return LinqExpr.Divide(LinqExpr.Constant(1.0), x);
+                    // Pow(-0, 0.5) is +0 and Pow(-Infinity, 0.5) is +Infinity, where Sqrt gives -0 and NaN.
+                    if (y == 0.5)
+                        return LinqExpr.Condition(
+                            LinqExpr.Equal(x, LinqExpr.Constant(double.NegativeInfinity)),
+                            LinqExpr.Constant(double.PositiveInfinity),
+                            LinqExpr.Add(LinqExpr.Call(typeof(Math).GetMethod(nameof(Math.Sqrt), new[] { typeof(double) }), x), LinqExpr.Constant(0.0)));
+                }
+                return node;
+            }
+        }
+
+        private class CommonSubexpressions : ExpressionVisitor
+        {
+            protected override LinqExpr VisitBlock(BlockExpression node)
+            {
+                return new BlockCommonSubexpressions(this).Optimize(node);
+            }
+        }
+
+        // Value numbering over the statements of one block. Values are numbered by structure, where
+        // a variable's number changes every time it is assigned. Any statement that isn't a simple
+        // assignment (labels, loops, branches, calls, nested blocks) starts a new epoch, and values
+        // are never shared across epochs.
+        private class BlockCommonSubexpressions
+        {
+            private ExpressionVisitor nested;
+
+            private Dictionary<string, int> numbers = new Dictionary<string, int>();
+            private Dictionary<ParameterExpression, int> versions = new Dictionary<ParameterExpression, int>();
+            private Dictionary<ParameterExpression, int> ids = new Dictionary<ParameterExpression, int>();
+            private int epoch = 0;
+            private Dictionary<LinqExpr, int> memo = new Dictionary<LinqExpr, int>();
+
+            private Dictionary<long, int> counts = new Dictionary<long, int>();
+            private Dictionary<long, ParameterExpression> temps = new Dictionary<long, ParameterExpression>();
+
+            public BlockCommonSubexpressions(ExpressionVisitor Nested) { nested = Nested; }
+
+            public LinqExpr Optimize(BlockExpression Block)
+            {
+                // Count the occurrences of each value.
+                foreach (LinqExpr i in Block.Expressions)
+                {
+                    LinqExpr target;
+                    IEnumerable<LinqExpr> reads;
+                    if (IsStatement(i, out target, out reads))
+                    {
+                        foreach (LinqExpr j in reads)
+                            CountValues(j);
+                        Assigned(target);
+                    }
+                    else
+                    {
+                        epoch++;
+                    }
+                }
+
+                // Replace the values that occur more than once with temporaries.
+                versions.Clear();
+                memo.Clear();
+                epoch = 0;
+                List<LinqExpr> statements = new List<LinqExpr>();
+                List<ParameterExpression> variables = Block.Variables.ToList();
+                foreach (LinqExpr i in Block.Expressions)
+                {
+                    LinqExpr target;
+                    IEnumerable<LinqExpr> reads;
+                    if (IsStatement(i, out target, out reads))
+                    {
+                        Rewriter rewriter = new Rewriter(this, statements, variables);
+                        statements.Add(rewriter.Visit(i));
+                        Assigned(target);
+                    }
+                    else
+                    {
+                        statements.Add(nested.Visit(i));
+                        epoch++;
+                    }
+                }
+
+                if (variables.Count == Block.Variables.Count && statements.SequenceEqual(Block.Expressions))
+                    return Block;
+                return LinqExpr.Block(Block.Type, variables, statements);
+            }
+
+            // Straight line statements: assignments of side effect free expressions to variables or
+            // array elements.
+            private static bool IsStatement(LinqExpr x, out LinqExpr Target, out IEnumerable<LinqExpr> Reads)
+            {
+                Target = null;
+                Reads = null;
+                if (x is BinaryExpression b && IsAssignment(b.NodeType) && b.Method == null && b.Conversion == null)
+                {
+                    Target = b.Left;
+                    if (b.Left is ParameterExpression)
+                        Reads = new[] { b.Right };
+                    else if (b.Left is IndexExpression index && index.Indexer == null)
+                        Reads = index.Arguments.Concat(new[] { index.Object, b.Right });
+                    else
+                        return false;
+                }
+                else if (x is UnaryExpression u && IsAssignment(u.NodeType) && u.Operand is ParameterExpression)
+                {
+                    Target = u.Operand;
+                    Reads = new LinqExpr[] { };
+                }
+                else
+                {
+                    return false;
+                }
+                return Reads.All(IsSideEffectFree);
+            }
+
+            private static bool IsAssignment(ExpressionType Type)
+            {
+                switch (Type)
+                {
+                    case ExpressionType.Assign:
+                    case ExpressionType.AddAssign:
+                    case ExpressionType.SubtractAssign:
+                    case ExpressionType.MultiplyAssign:
+                    case ExpressionType.DivideAssign:
+                    case ExpressionType.AndAssign:
+                    case ExpressionType.OrAssign:
+                    case ExpressionType.PreIncrementAssign:
+                    case ExpressionType.PreDecrementAssign:
+                    case ExpressionType.PostIncrementAssign:
+                    case ExpressionType.PostDecrementAssign:
+                        return true;
+                    default:
+                        return false;
+                }
+            }
+
+            // Reads that don't change any state, but may throw (array indexing, integer division).
+            private static bool IsSideEffectFree(LinqExpr x)
+            {
+                if (IsPure(x))
+                    return true;
+                switch (x)
+                {
+                    case BinaryExpression b:
+                        return !IsAssignment(b.NodeType) && b.Method == null && IsSideEffectFree(b.Left) && IsSideEffectFree(b.Right);
+                    case UnaryExpression u:
+                        return !IsAssignment(u.NodeType) && u.NodeType != ExpressionType.Throw && u.Method == null && IsSideEffectFree(u.Operand);
+                    case IndexExpression index:
+                        return index.Indexer == null && IsSideEffectFree(index.Object) && index.Arguments.All(IsSideEffectFree);
+                    case ConditionalExpression c:
+                        return IsSideEffectFree(c.Test) && IsSideEffectFree(c.IfTrue) && IsSideEffectFree(c.IfFalse);
+                    case MethodCallExpression call:
+                        return IsPureMethod(call.Method) && call.Arguments.All(IsSideEffectFree);
+                    default:
+                        return false;
+                }
+            }
+
+            private void Assigned(LinqExpr Target)
+            {
+                if (Target is ParameterExpression p)
+                {
+                    versions.TryGetValue(p, out int v);
+                    versions[p] = v + 1;
+                    memo.Clear();
+                }
+            }
+
+            // Values worth a temporary: operations, not variables or constants.
+            private static bool IsCandidate(LinqExpr x)
+            {
+                switch (x.NodeType)
+                {
+                    case ExpressionType.Constant:
+                    case ExpressionType.Parameter:
+                    case ExpressionType.Convert:
+                    case ExpressionType.UnaryPlus:
+                        return false;
+                    default:
+                        return x.Type != typeof(void) && IsPure(x);
+                }
+            }
+
+            private long Key(int Number) { return ((long)epoch << 32) | (uint)Number; }
+
+            private int Id(ParameterExpression x)
+            {
+                if (!ids.TryGetValue(x, out int id))
+                    ids.Add(x, id = ids.Count);
+                return id;
+            }
+
+            // Number a pure expression by structure.
+            private int Number(LinqExpr x)
+            {
+                if (memo.TryGetValue(x, out int n))
+                    return n;
+
+                string signature;
+                switch (x)
+                {
+                    case ConstantExpression c:
+                        signature = "C " + x.Type + " " + (c.Value is double d ? d.ToString("R", CultureInfo.InvariantCulture) : Convert.ToString(c.Value, CultureInfo.InvariantCulture));
+                        break;
+                    case ParameterExpression p:
+                        versions.TryGetValue(p, out int v);
+                        signature = "P " + Id(p) + " " + v;
+                        break;
+                    case BinaryExpression b:
+                        int l = Number(b.Left), r = Number(b.Right);
+                        // Floating point add and multiply are commutative.
+                        if ((b.NodeType == ExpressionType.Add || b.NodeType == ExpressionType.Multiply) && l > r)
+                        {
+                            int t = l; l = r; r = t;
+                        }
+                        signature = b.NodeType + " " + x.Type + " " + l + " " + r;
+                        break;
+                    case UnaryExpression u:
+                        signature = u.NodeType + " " + x.Type + " " + Number(u.Operand);
+                        break;
+                    case ConditionalExpression c:
+                        signature = "?: " + x.Type + " " + Number(c.Test) + " " + Number(c.IfTrue) + " " + Number(c.IfFalse);
+                        break;
+                    case MethodCallExpression call:
+                        signature = "Call " + call.Method.DeclaringType + "." + call.Method + " " + string.Join(" ", call.Arguments.Select(Number));
+                        break;
+                    default:
+                        throw new NotSupportedException(x.NodeType.ToString());
+                }
+
+                if (!numbers.TryGetValue(signature, out n))
+                    numbers.Add(signature, n = numbers.Count);
+                memo[x] = n;
+                return n;
+            }
+
+            private void CountValues(LinqExpr x)
+            {
+                if (x == null)
+                    return;
+                if (IsCandidate(x))
+                {
+                    long key = Key(Number(x));
+                    counts.TryGetValue(key, out int count);
+                    counts[key] = count + 1;
+                    // Repeats will be replaced by the temporary, their subexpressions aren't evaluated again.
+                    if (count > 0)
+                        return;
+                }
+                foreach (LinqExpr i in Children(x))
+                    CountValues(i);
+            }
+
+            private static IEnumerable<LinqExpr> Children(LinqExpr x)
+            {
+                switch (x)
+                {
+                    case BinaryExpression b: return new[] { b.Left, b.Right };
+                    case UnaryExpression u: return new[] { u.Operand };
+                    case ConditionalExpression c: return new[] { c.Test, c.IfTrue, c.IfFalse };
+                    case MethodCallExpression call: return call.Arguments;
+                    case IndexExpression index: return index.Arguments.Concat(new[] { index.Object });
+                    default: return new LinqExpr[] { };
+                }
+            }
+
+            // Rewrites one statement, adding the temporaries it defines to the statements before it.
+            private class Rewriter : ExpressionVisitor
+            {
+                private BlockCommonSubexpressions block;
+                private List<LinqExpr> statements;
+                private List<ParameterExpression> variables;
+
+                public Rewriter(BlockCommonSubexpressions Block, List<LinqExpr> Statements, List<ParameterExpression> Variables)
+                {
+                    block = Block;
+                    statements = Statements;
+                    variables = Variables;
+                }
+
+                public override LinqExpr Visit(LinqExpr node)
+                {
+                    if (node == null || !IsCandidate(node))
+                        return base.Visit(node);
+
+                    long key = block.Key(block.Number(node));
+                    if (block.counts[key] < 2)
+                        return base.Visit(node);
+
+                    if (!block.temps.TryGetValue(key, out ParameterExpression temp))
+                    {
+                        LinqExpr value = base.Visit(node);
+                        temp = LinqExpr.Variable(node.Type, "cse" + block.temps.Count);
+                        variables.Add(temp);
+                        statements.Add(LinqExpr.Assign(temp, value));
+                        block.temps.Add(key, temp);
+                    }
+                    return temp;
+                }
+            }
+        }
+    }
+}
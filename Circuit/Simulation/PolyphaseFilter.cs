@@ -0,0 +1,195 @@
+﻿using System;
+
+namespace Circuit
+{
+    /// <summary>
+    /// Methods of resampling the input and output of a simulation to and from the oversampled rate.
+    /// </summary>
+    public enum Resampling
+    {
+        /// <summary>
+        /// Linear interpolation of the input, average of the output. No latency, but aliases.
+        /// </summary>
+        Linear,
+        /// <summary>
+        /// Polyphase windowed sinc FIR filters. Adds PolyphaseFilter.TapsPerPhase samples of latency.
+        /// </summary>
+        Polyphase,
+    }
+
+    /// <summary>
+    /// Kaiser windowed sinc lowpass filter for resampling by an integer factor, with the cutoff at the
+    /// Nyquist frequency of the lower rate. The passband extends to 0.42x and the stopband (-80 dB)
+    /// begins at 0.58x the lower sample rate.
+    /// 
+    /// The filter has TapsPerPhase*Factor + 1 taps, which delays the signal by TapsPerPhase/2 samples
+    /// of the lower rate. The taps are zero padded to (TapsPerPhase + 1)*Factor so every phase has the
+    /// same length.
+    /// </summary>
+    public static class PolyphaseFilter
+    {
+        /// <summary>
+        /// Length of the filter, in samples of the lower rate.
+        /// </summary>
+        public const int TapsPerPhase = 32;
+
+        /// <summary>
+        /// Latency of an interpolator followed by a decimator, in samples of the lower rate.
+        /// </summary>
+        public const int Latency = TapsPerPhase;
+
+        private const double Beta = 8.0;
+
+        /// <summary>
+        /// Design the filter for the given factor. The taps sum to 1.
+        /// </summary>
+        public static double[] Design(int Factor)
+        {
+            int length = TapsPerPhase * Factor + 1;
+            double center = TapsPerPhase * Factor / 2.0;
+            double[] h = new double[(TapsPerPhase + 1) * Factor];
+
+            double sum = 0.0;
+            for (int i = 0; i < length; i++)
+            {
+                double x = (i - center) / Factor;
+                double sinc = x == 0.0 ? 1.0 : Math.Sin(Math.PI * x) / (Math.PI * x);
+                double w = (i - center) / center;
+                h[i] = sinc * BesselI0(Beta * Math.Sqrt(1.0 - w * w)) / BesselI0(Beta);
+                sum += h[i];
+            }
+            for (int i = 0; i < length; i++)
+                h[i] /= sum;
+            return h;
+        }
+
+        // Modified Bessel function of the first kind, order 0.
+        private static double BesselI0(double x)
+        {
+            double sum = 1.0, term = 1.0;
+            for (int k = 1; term > sum * 1e-17; k++)
+            {
+                term *= (x / (2 * k)) * (x / (2 * k));
+                sum += term;
+            }
+            return sum;
+        }
+    }
+
+    /// <summary>
+    /// Upsamples a signal by an integer factor with a polyphase PolyphaseFilter.
+    /// </summary>
+    public class Interpolator
+    {
+        private int factor;
+        /// <summary>
+        /// Upsampling factor.
+        /// </summary>
+        public int Factor { get { return factor; } }
+
+        private double[] h;
+        // Input history, newest first, stored twice so the window is always contiguous.
+        private double[] history;
+        private int taps, at = 0;
+
+        public Interpolator(int Factor)
+        {
+            factor = Factor;
+            taps = PolyphaseFilter.TapsPerPhase + 1;
+            // Scale by the factor to make up for the zeros inserted between input samples.
+            h = PolyphaseFilter.Design(Factor);
+            for (int i = 0; i < h.Length; i++)
+                h[i] *= Factor;
+            history = new double[2 * taps];
+        }
+
+        /// <summary>
+        /// Upsample N samples of Input to N*Factor samples of Output.
+        /// </summary>
+        public void Process(double[] Input, int N, double[] Output) { Process(Input, 0, N, Output); }
+        /// <summary>
+        /// Upsample N samples of Input, starting at InputOffset, to N*Factor samples of Output.
+        /// </summary>
+        public void Process(double[] Input, int InputOffset, int N, double[] Output)
+        {
+            for (int n = 0; n < N; n++)
+            {
+                at = at == 0 ? taps - 1 : at - 1;
+                history[at] = history[at + taps] = Input[InputOffset + n];
+
+                for (int k = 0; k < factor; k++)
+                {
+                    double y = 0.0;
+                    for (int j = 0, i = k; j < taps; j++, i += factor)
+                        y += h[i] * history[at + j];
+                    Output[n * factor + k] = y;
+                }
+            }
+        }
+
+        /// <summary>
+        /// Clear the filter state.
+        /// </summary>
+        public void Reset() { Array.Clear(history, 0, history.Length); }
+    }
+
+    /// <summary>
+    /// Downsamples a signal by an integer factor with a polyphase PolyphaseFilter. Only the samples that
+    /// are kept are filtered.
+    /// </summary>
+    public class Decimator
+    {
+        private int factor;
+        /// <summary>
+        /// Downsampling factor.
+        /// </summary>
+        public int Factor { get { return factor; } }
+
+        private double[] h;
+        // Input history, newest first, stored twice so the window is always contiguous.
+        private double[] history;
+        private int taps, at = 0;
+
+        public Decimator(int Factor)
+        {
+            factor = Factor;
+            h = PolyphaseFilter.Design(Factor);
+            taps = h.Length;
+            history = new double[2 * taps];
+        }
+
+        /// <summary>
+        /// Downsample N*Factor samples of Input to N samples of Output.
+        /// </summary>
+        public void Process(double[] Input, int N, double[] Output) { Process(Input, N, Output, 0); }
+        /// <summary>
+        /// Downsample N*Factor samples of Input to N samples of Output, starting at OutputOffset.
+        /// </summary>
+        public void Process(double[] Input, int N, double[] Output, int OutputOffset)
+        {
+            for (int n = 0; n < N; n++)
+            {
+                for (int k = 0; k < factor; k++)
+                {
+                    at = at == 0 ? taps - 1 : at - 1;
+                    history[at] = history[at + taps] = Input[n * factor + k];
+
+                    // The output sample lines up with the first of each group of Factor input samples,
+                    // which makes the delay of an interpolator and decimator pair a whole number of samples.
+                    if (k == 0)
+                    {
+                        double y = 0.0;
+                        for (int i = 0; i < taps; i++)
+                            y += h[i] * history[at + i];
+                        Output[OutputOffset + n] = y;
+                    }
+                }
+            }
+        }
+
+        /// <summary>
+        /// Clear the filter state.
+        /// </summary>
+        public void Reset() { Array.Clear(history, 0, history.Length); }
+    }
+}
@@ -5,6 +5,8 @@
 using System.Linq;
 using System.Numerics;
 using System.Reflection;
+using System.Threading;
+using System.Threading.Tasks;
 using Util;
 using LinqExpr = System.Linq.Expressions.Expression;
 using ParamExpr = System.Linq.Expressions.ParameterExpression;
@@ -66,7 +68,7 @@ public class Simulation
         public TransientSolution Solution
         {
             get { return solution; }
-            set { solution = value; InvalidateProcess(); }
+            set { solution = value; DefineParameters(); InvalidateProcess(); }
         }
 
         private int oversample = 8;
@@ -75,12 +77,44 @@ public TransientSolution Solution
         /// </summary>
         public int Oversample { get { return oversample; } set { oversample = value; InvalidateProcess(); } }
 
+        private Resampling resampling = Resampling.Linear;
+        /// <summary>
+        /// How the input and output are resampled to and from the oversampled rate.
+        /// </summary>
+        public Resampling Resampling { get { return resampling; } set { resampling = value; InvalidateProcess(); } }
+
+        /// <summary>
+        /// Delay of the output relative to the input introduced by resampling, in samples. This is the
+        /// latency of the process function that is running, which lags behind the settings while its
+        /// replacement compiles.
+        /// </summary>
+        public int Latency
+        {
+            get
+            {
+                Process current = process;
+                return current != null ? current.Latency : IsResampled ? PolyphaseFilter.Latency : 0;
+            }
+        }
+
+        // The polyphase filters resample the signals outside of the process function, which then
+        // runs at the oversampled rate.
+        private bool IsResampled { get { return resampling == Resampling.Polyphase && oversample > 1; } }
+
         private int iterations = 8;
         /// <summary>
         /// Maximum number of iterations allowed for the simulation to converge.
         /// </summary>
         public int Iterations { get { return iterations; } set { iterations = value; InvalidateProcess(); } }
 
+        private double approximationError = 0.0;
+        /// <summary>
+        /// Largest relative error allowed in exp/log/pow when evaluating the solution. If this is at least
+        /// FastMath.MinError, the calls to System.Math in the whole process function are replaced with
+        /// table driven approximations. 0, the default, keeps the math exact.
+        /// </summary>
+        public double ApproximationError { get { return approximationError; } set { approximationError = value; InvalidateProcess(); } }
+
         /// <summary>
         /// The sampling rate of this simulation, the sampling rate of the transient solution divided by the oversampling factor.
         /// </summary>
@@ -100,6 +134,41 @@ public TransientSolution Solution
 
         // Stores any global state in the simulation (previous state values, mostly).
         private Dictionary<Expression, GlobalExpr<double>> globals = new Dictionary<Expression, GlobalExpr<double>>();
+        /// <summary>
+        /// Number of values the simulation keeps from one timestep to the next.
+        /// </summary>
+        public int StateSize { get { return globals.Count; } }
+        // Values of the parameters of the solution, read by the process function at the start of each block.
+        private Dictionary<Expression, GlobalExpr<double>> parameters = new Dictionary<Expression, GlobalExpr<double>>();
+        /// <summary>
+        /// Parameters of the solution, such as the positions of potentiometers in a parametric analysis.
+        /// </summary>
+        public IEnumerable<Parameter> Parameters { get { return solution.Parameters; } }
+
+        /// <summary>
+        /// Read the current values of the parameters. They take effect at the start of the next block, without
+        /// solving or compiling the simulation again.
+        /// </summary>
+        public void UpdateParameters()
+        {
+            Dictionary<Expression, GlobalExpr<double>> values = parameters;
+            foreach (Parameter i in solution.Parameters)
+                if (values.TryGetValue(i.Variable, out GlobalExpr<double> value))
+                    value.Value = i.Value;
+        }
+
+        // Add values for the parameters of a new solution. The dictionary is replaced rather than
+        // modified, because a process function may be compiling from it in the background.
+        private void DefineParameters()
+        {
+            var values = new Dictionary<Expression, GlobalExpr<double>>(parameters);
+            foreach (Parameter i in solution.Parameters)
+                if (!values.ContainsKey(i.Variable))
+                    values.Add(i.Variable, new GlobalExpr<double>(0.0));
+            parameters = values;
+            UpdateParameters();
+        }
+
         // Add a new global and set it to 0 if it didn't already exist.
         private void AddGlobal(Expression Name)
         {
@@ -116,6 +185,7 @@ private void AddGlobal(Expression Name)
         public Simulation(TransientSolution Solution)
         {
             solution = Solution;
+            DefineParameters();
 
             // If any system depends on the previous value of an unknown, we need a global variable for it.
             for (int n = -1; n >= MaxDelay; n--)
@@ -155,14 +225,30 @@ public Simulation(TransientSolution Solution)
         /// <param name="Output">Buffers to receive output samples.</param>
         public void Run(int N, IEnumerable<double[]> Input, IEnumerable<double[]> Output)
         {
-            if (_process == null)
-                _process = DefineProcess();
+            Run(N, Buffers(Input, ref inputBuffers), Buffers(Output, ref outputBuffers));
+        }
+        /// <summary>
+        /// Process some samples with this simulation, without allocating. The Input and Output buffers must match
+        /// the enumerations provided at initialization.
+        /// </summary>
+        /// <param name="N">Number of samples to process.</param>
+        /// <param name="Input">Buffers that describe the input samples.</param>
+        /// <param name="Output">Buffers to receive output samples.</param>
+        public void Run(int N, double[][] Input, double[][] Output)
+        {
+            // Keep running the current process function while its replacement compiles, unless it
+            // was compiled for different buffers.
+            Process current = this.process;
+            Process process = CurrentProcess(current == null || current.Inputs != Input.Length || current.Outputs != Output.Length);
 
             try
             {
                 try
                 {
-                    _process(N, n*TimeStep, Input.AsArray(), Output.AsArray());
+                    if (process.IsResampled)
+                        RunResampled(process, N, Input, Output);
+                    else
+                        process.Run(N, n * process.TimeStep, Input, Output);
                     n += N;
                 }
                 catch (TargetInvocationException Ex)
@@ -175,22 +261,199 @@ public void Run(int N, IEnumerable<double[]> Input, IEnumerable<double[]> Output
                 throw new SimulationDiverged("Simulation diverged near t = " + Quantity.ToString(Time, Units.s) + " + " + Ex.At, n + Ex.At);
             }
         }
-        public void Run(int N, IEnumerable<double[]> Output) { Run(N, new double[][] { }, Output); }
-        public void Run(double[] Input, IEnumerable<double[]> Output) { Run(Input.Length, new[] { Input }, Output); }
-        public void Run(double[] Input, double[] Output) { Run(Input.Length, new[] { Input }, new[] { Output }); }
+        public void Run(int N, IEnumerable<double[]> Output) { Run(N, NoBuffers, Buffers(Output, ref outputBuffers)); }
+        public void Run(double[] Input, IEnumerable<double[]> Output) { Run(Input.Length, Buffer(Input, ref inputBuffers), Buffers(Output, ref outputBuffers)); }
+        public void Run(double[] Input, double[] Output) { Run(Input.Length, Buffer(Input, ref inputBuffers), Buffer(Output, ref outputBuffers)); }
+
+        // The process function takes arrays of buffers. Callers that pass other collections (or
+        // single buffers) have them copied into these, which are reused from one call to the next
+        // so that processing does not allocate on the audio thread.
+        private static readonly double[][] NoBuffers = new double[][] { };
+        private double[][] inputBuffers, outputBuffers;
+        private static double[][] Buffers(IEnumerable<double[]> Source, ref double[][] Cache)
+        {
+            if (Source is double[][] array)
+                return array;
+            if (Source is IList<double[]> list)
+            {
+                if (Cache == null || Cache.Length != list.Count)
+                    Cache = new double[list.Count][];
+                for (int i = 0; i < Cache.Length; ++i)
+                    Cache[i] = list[i];
+                return Cache;
+            }
+            return Source.ToArray();
+        }
+        private static double[][] Buffer(double[] Source, ref double[][] Cache)
+        {
+            if (Cache == null || Cache.Length != 1)
+                Cache = new double[1][];
+            Cache[0] = Source;
+            return Cache;
+        }
+
+        // A compiled process function, and the settings it was compiled with.
+        private class Process
+        {
+            public Action<int, double, double[][], double[][]> Run;
+            public TransientSolution Solution;
+            // TimeStep is an expression evaluation, which allocates, so it is computed once here.
+            public double TimeStep;
+            public int Oversample;
+            public bool IsResampled;
+            public int Latency;
+            public int Iterations;
+            public double ApproximationError;
+            public Expression[] Input, Output;
+            public int Inputs, Outputs;
+            public Dictionary<Expression, GlobalExpr<double>> Parameters;
+            public OperationCount Operations;
+            // Resampling filters and oversampled buffers, allocated with the process function so
+            // that Run doesn't allocate. Null if the process function isn't resampled.
+            public Interpolator[] Interpolators;
+            public Decimator[] Decimators;
+            public double[][] OversampledInput, OversampledOutput;
+        }
+
+        private volatile Process process;
+        // Replacement for the process function, compiling in the background.
+        private volatile Task<Process> pending;
+        private int version = 0;
+        // Compilation reads (and adds to) the globals, so only one process function is compiled at a time.
+        private readonly object compiling = new object();
+
+        // The current settings, for a process function to be compiled with. The compilation only
+        // reads these, so changes made while it runs can't mix into it.
+        private Process Settings()
+        {
+            return new Process()
+            {
+                Solution = solution,
+                TimeStep = TimeStep,
+                Oversample = oversample,
+                IsResampled = IsResampled,
+                Latency = IsResampled ? PolyphaseFilter.Latency : 0,
+                Iterations = iterations,
+                ApproximationError = approximationError,
+                Input = input,
+                Output = output,
+                Inputs = input.Length,
+                Outputs = output.Length,
+                Parameters = parameters,
+            };
+        }
 
-        private Action<int, double, double[][], double[][]> _process;
-        // Force rebuilding of the process function.
+        // Rebuild the process function. The replacement is compiled on a background thread and
+        // swapped in by Run at the start of a block when it is ready, so changing the settings does
+        // not stall the audio thread.
         private void InvalidateProcess()
         {
-            _process = null;
+            int v = Interlocked.Increment(ref version);
+            Process settings = Settings();
+            pending = Task.Run(() =>
+            {
+                lock (compiling)
+                {
+                    // Settings that changed again while this was waiting have their own task.
+                    if (v != Volatile.Read(ref version))
+                        return null;
+                    Process compiled = DefineProcess(settings);
+                    return v == Volatile.Read(ref version) ? compiled : null;
+                }
+            });
+        }
+
+        // Get the process function to run the next block with, swapping in a compiled replacement.
+        // If Wait is true, a replacement that is still compiling is waited for. The calling thread
+        // never compiles, it only waits for the background compilation.
+        private Process CurrentProcess(bool Wait)
+        {
+            while (true)
+            {
+                for (Task<Process> next = pending; next != null && (Wait || next.IsCompleted); next = pending)
+                {
+                    // Settings may have changed again, replacing the pending task.
+                    if (Interlocked.CompareExchange(ref pending, null, next) != next)
+                        continue;
+                    Process compiled = next.GetAwaiter().GetResult();
+                    if (compiled != null)
+                        Swap(compiled);
+                }
+                if (process != null || !Wait)
+                    return process;
+                // The last compilation failed (and threw above), try again.
+                InvalidateProcess();
+            }
+        }
+
+        // The state of the simulation is in the globals, which the replacement picks up from
+        // where the current process function left them. The state of the resampling filters is
+        // kept too, unless the filters no longer fit the replacement.
+        private void Swap(Process Replacement)
+        {
+            Process current = process;
+            if (current != null && current.IsResampled && Replacement.IsResampled && current.Oversample == Replacement.Oversample
+                && current.Inputs == Replacement.Inputs && current.Outputs == Replacement.Outputs)
+            {
+                Replacement.Interpolators = current.Interpolators;
+                Replacement.Decimators = current.Decimators;
+            }
+            process = Replacement;
+        }
+
+        /// <summary>
+        /// Operations in the process function. Each operation counts once, so this is the cost of one
+        /// oversampled step with one iteration of each Newton's method system, plus the small per
+        /// sample overhead.
+        /// </summary>
+        public OperationCount Operations { get { return CurrentProcess(true).Operations; } }
+
+        /// <summary>
+        /// Wait for the process function to compile. The first call to Run waits for it otherwise, so
+        /// a simulation built on another thread should be compiled before it is handed to the audio
+        /// thread.
+        /// </summary>
+        public void Compile() { CurrentProcess(true); }
+
+        // Largest number of samples resampled at once. Longer blocks are processed in pieces of
+        // this size, so the oversampled buffers can be allocated up front.
+        private const int MaxResampledBlock = 512;
+
+        // Upsample the input, run the process function at the oversampled rate, and downsample the output.
+        private void RunResampled(Process Process, int N, double[][] Input, double[][] Output)
+        {
+            int oversample = Process.Oversample;
+            for (int offset = 0; offset < N; offset += MaxResampledBlock)
+            {
+                int block = Math.Min(N - offset, MaxResampledBlock);
+                for (int i = 0; i < Input.Length; i++)
+                    Process.Interpolators[i].Process(Input[i], offset, block, Process.OversampledInput[i]);
+                try
+                {
+                    Process.Run(block * oversample, (n + offset) * Process.TimeStep, Process.OversampledInput, Process.OversampledOutput);
+                }
+                catch (SimulationDiverged Ex)
+                {
+                    throw new SimulationDiverged(offset + (int)(Ex.At / oversample));
+                }
+                for (int i = 0; i < Output.Length; i++)
+                    Process.Decimators[i].Process(Process.OversampledOutput[i], block, Output[i], offset);
+            }
         }
 
         // The resulting lambda processes N samples, using buffers provided for Input and Output:
         //  void Process(int N, double t0, double T, double[] Input0 ..., double[] Output0 ...)
         //  { ... }
-        private Action<int, double, double[][], double[][]> DefineProcess()
+        private Process DefineProcess(Process result)
         {
+            if (result.IsResampled)
+            {
+                result.Interpolators = result.Input.Select(i => new Interpolator(result.Oversample)).ToArray();
+                result.Decimators = result.Output.Select(i => new Decimator(result.Oversample)).ToArray();
+                result.OversampledInput = result.Input.Select(i => new double[MaxResampledBlock * result.Oversample]).ToArray();
+                result.OversampledOutput = result.Output.Select(i => new double[MaxResampledBlock * result.Oversample]).ToArray();
+            }
+
             // Map expressions to identifiers in the syntax tree.
             var inputs = new List<KeyValuePair<Expression, LinqExpr>>();
             var outputs = new List<KeyValuePair<Expression, LinqExpr>>();
@@ -205,21 +468,21 @@ private void InvalidateProcess()
             var outs = code.Decl<double[][]>(Scope.Parameter, "outs");
 
             // Create buffer parameters for each input...
-            for (int i = 0; i < input.Length; i++)
+            for (int i = 0; i < result.Input.Length; i++)
             {
-                inputs.Add(new KeyValuePair<Expression, LinqExpr>(input[i], LinqExpr.ArrayAccess(ins, LinqExpr.Constant(i))));
+                inputs.Add(new KeyValuePair<Expression, LinqExpr>(result.Input[i], LinqExpr.ArrayAccess(ins, LinqExpr.Constant(i))));
             }
 
             // ... and output.
-            for (int i = 0; i < output.Length; i++)
+            for (int i = 0; i < result.Output.Length; i++)
             {
-                outputs.Add(new KeyValuePair<Expression, LinqExpr>(output[i], LinqExpr.ArrayAccess(outs, LinqExpr.Constant(i))));
+                outputs.Add(new KeyValuePair<Expression, LinqExpr>(result.Output[i], LinqExpr.ArrayAccess(outs, LinqExpr.Constant(i))));
             }
 
-            Arrow t_t1 = Arrow.New(Simulation.t, Simulation.t - Solution.TimeStep);
+            Arrow t_t1 = Arrow.New(Simulation.t, Simulation.t - result.Solution.TimeStep);
 
             // Create globals to store previous values of inputs.
-            foreach (Expression i in Input.Distinct())
+            foreach (Expression i in result.Input.Distinct())
                 AddGlobal(i.Evaluate(t_t1));
 
             // Define lambda body.
@@ -228,30 +491,40 @@ private void InvalidateProcess()
             LinqExpr Zero = LinqExpr.Constant(0);
 
             // double h = T / Oversample
-            LinqExpr h = LinqExpr.Constant(TimeStep / (double)Oversample);
+            LinqExpr h = LinqExpr.Constant(result.TimeStep / (double)result.Oversample);
+
+            // Number of steps per sample of the input/output buffers. When resampled, the buffers are
+            // already at the oversampled rate.
+            int steps = result.IsResampled ? 1 : result.Oversample;
 
             // double invOversample = 1 / Oversample
-            LinqExpr invOversample = LinqExpr.Constant(1.0 / (double)Oversample);
+            LinqExpr invOversample = LinqExpr.Constant(1.0 / (double)steps);
 
             // Load the globals to local variables and add them to the map.
             foreach (KeyValuePair<Expression, GlobalExpr<double>> i in globals)
                 code.DeclInit(i.Key, i.Value);
 
+            // The parameters are loaded the same way, but never stored back.
+            foreach (KeyValuePair<Expression, GlobalExpr<double>> i in result.Parameters)
+                code.DeclInit(i.Key, i.Value);
+
             foreach (KeyValuePair<Expression, LinqExpr> i in inputs)
                 code.DeclInit(i.Key, code[i.Key.Evaluate(t_t1)]);
 
             // Create arrays for linear systems.
-            int M = Solution.Solutions.OfType<NewtonIteration>().Max(i => i.Equations.Count(), 0);
-            int N = Solution.Solutions.OfType<NewtonIteration>().Max(i => i.UnknownDeltas.Count(), 0);
+            int M = result.Solution.Solutions.OfType<NewtonIteration>().Max(i => i.Equations.Count(), 0);
+            int N = result.Solution.Solutions.OfType<NewtonIteration>().Max(i => i.UnknownDeltas.Count(), 0);
             // If there is an underdetermined system of equations, avoid out of bounds reads.
             M = Math.Max(M, N);
             // Add a column for the solution vector.
             ++N;
             Log.WriteLine(MessageType.Verbose, Vector.IsHardwareAccelerated ? "Vector hardware acceleration enabled" : "No vector hardware acceleration");
 
-            LinqExpr JxF = code.DeclInit<double[][]>("JxF", LinqExpr.NewArrayBounds(typeof(double[]), LinqExpr.Constant(M)));
-            for (int j = 0; j < M; ++j)
-                code.Add(LinqExpr.Assign(LinqExpr.ArrayAccess(JxF, LinqExpr.Constant(j)), LinqExpr.NewArrayBounds(typeof(double), Vector.IsHardwareAccelerated ? LinqExpr.Constant(N + Vector<double>.Count - 1) : LinqExpr.Constant(N))));
+            // The systems share one flat column-major matrix, with the columns padded to whole vectors
+            // and one more column for the row multipliers of the elimination.
+            int stride = SolveStride(M);
+            // The matrix is allocated once, with the process function, rather than on every call.
+            LinqExpr JxF = code.DeclInit<double[]>("JxF", LinqExpr.Constant(new double[stride * (N + 1)]));
 
             // for (int n = 0; n < SampleCount; ++n)
             ParamExpr n = code.Decl<int>("n");
@@ -263,7 +536,7 @@ private void InvalidateProcess()
                 {
                     // Prepare input samples for oversampling interpolation.
                     Dictionary<Expression, LinqExpr> dVi = new Dictionary<Expression, LinqExpr>();
-                    foreach (Expression i in Input.Distinct())
+                    foreach (Expression i in result.Input.Distinct())
                     {
                         LinqExpr Va = code[i];
                         // Sum all inputs with this key.
@@ -280,7 +553,7 @@ private void InvalidateProcess()
 
                     // Prepare output sample accumulators for low pass filtering.
                     Dictionary<Expression, LinqExpr> Vo = new Dictionary<Expression, LinqExpr>();
-                    foreach (Expression i in Output.Distinct())
+                    foreach (Expression i in result.Output.Distinct())
                         code.Add(LinqExpr.Assign(
                             Decl<double>(code, Vo, i, i.ToString().Replace("[t]", "")),
                             LinqExpr.Constant(0.0)));
@@ -288,18 +561,18 @@ private void InvalidateProcess()
                     // int ov = Oversample; 
                     // do { -- ov; } while(ov > 0)
                     ParamExpr ov = code.Decl<int>("ov");
-                    code.Add(LinqExpr.Assign(ov, LinqExpr.Constant(Oversample)));
+                    code.Add(LinqExpr.Assign(ov, LinqExpr.Constant(steps)));
                     code.DoWhile(() =>
                     {
                         // t += h
                         code.Add(LinqExpr.AddAssign(t, h));
 
                         // Interpolate the input samples.
-                        foreach (Expression i in Input.Distinct())
+                        foreach (Expression i in result.Input.Distinct())
                             code.Add(LinqExpr.AddAssign(code[i], dVi[i]));
 
                         // Compile all of the SolutionSets in the solution.
-                        foreach (SolutionSet ss in Solution.Solutions)
+                        foreach (SolutionSet ss in result.Solution.Solutions)
                         {
                             if (ss is LinearSolutions)
                             {
@@ -317,12 +590,12 @@ private void InvalidateProcess()
                                     code.DeclInit(i.Left, i.Right);
 
                                 // int it = iterations
-                                LinqExpr it = code.ReDeclInit<int>("it", Iterations);
+                                LinqExpr it = code.ReDeclInit<int>("it", result.Iterations);
                                 // do { ... --it } while(it > 0)
                                 code.DoWhile((Break) =>
                                 {
                                     // Solve the un-solved system.
-                                    Solve(code, JxF, S.Equations, S.UnknownDeltas);
+                                    Solve(code, JxF, stride, S.Equations, S.UnknownDeltas);
 
                                     // Compile the pre-solved solutions.
                                     if (S.KnownDeltas != null)
@@ -359,19 +632,19 @@ private void InvalidateProcess()
                         }
 
                         // Update the previous timestep variables.
-                        foreach (SolutionSet S in Solution.Solutions)
+                        foreach (SolutionSet S in result.Solution.Solutions)
                         {
                             for (int m = MaxDelay; m < 0; m++)
                             {
-                                Arrow t_tm = Arrow.New(Simulation.t, Simulation.t + m * Solution.TimeStep);
-                                Arrow t_tm1 = Arrow.New(Simulation.t, Simulation.t + (m + 1) * Solution.TimeStep);
+                                Arrow t_tm = Arrow.New(Simulation.t, Simulation.t + m * result.Solution.TimeStep);
+                                Arrow t_tm1 = Arrow.New(Simulation.t, Simulation.t + (m + 1) * result.Solution.TimeStep);
                                 foreach (Expression i in S.Unknowns.Where(i => globals.Keys.Contains(i.Evaluate(t_tm))))
                                     code.Add(LinqExpr.Assign(code[i.Evaluate(t_tm)], code[i.Evaluate(t_tm1)]));
                             }
                         }
 
                         // Vo += i
-                        foreach (Expression i in Output.Distinct())
+                        foreach (Expression i in result.Output.Distinct())
                         {
                             LinqExpr Voi = LinqExpr.Constant(0.0);
                             try
@@ -386,7 +659,7 @@ private void InvalidateProcess()
                         }
 
                         // Vi_t0 = Vi
-                        foreach (Expression i in Input.Distinct())
+                        foreach (Expression i in result.Input.Distinct())
                             code.Add(LinqExpr.Assign(code[i.Evaluate(t_t1)], code[i]));
 
                         // --ov;
@@ -397,12 +670,17 @@ private void InvalidateProcess()
                     foreach (KeyValuePair<Expression, LinqExpr> i in outputs)
                         code.Add(LinqExpr.Assign(LinqExpr.ArrayAccess(i.Value, n), LinqExpr.Multiply(Vo[i.Key], invOversample)));
 
-                    // Every 256 samples, check for divergence.
-                    if (Vo.Any())
+                    // Every 256 samples, check for divergence, and flush sub-normal state to zero. A
+                    // decaying tail would otherwise spend a long time in the sub-normal range, where
+                    // every operation on it is many times slower.
+                    List<LinqExpr> state = globals.Keys.Select(i => code[i]).ToList();
+                    if (Vo.Any() || state.Any())
                         code.Add(LinqExpr.IfThen(LinqExpr.Equal(LinqExpr.And(n, LinqExpr.Constant(0xFF)), Zero),
-                            LinqExpr.Block(Vo.Select(i => LinqExpr.IfThenElse(IsNotReal(i.Value),
-                                ThrowSimulationDiverged(n),
-                                LinqExpr.Assign(i.Value, RoundDenormToZero(i.Value)))))));
+                            LinqExpr.Block(
+                                Vo.Select(i => LinqExpr.IfThenElse(IsNotReal(i.Value),
+                                    ThrowSimulationDiverged(n),
+                                    LinqExpr.Assign(i.Value, RoundDenormToZero(i.Value))))
+                                .Concat(state.Select(i => LinqExpr.Assign(i, RoundDenormToZero(i)))))));
                 });
 
             // Copy the global state variables back to the globals.
@@ -410,11 +688,24 @@ private void InvalidateProcess()
                 code.Add(LinqExpr.Assign(i.Value, code[i.Key]));
 
             var lambda = code.Build<Action<int, double, double[][], double[][]>>();
-            return lambda.Compile();
+
+            // Share repeated subexpressions and replace divisions by constants.
+            OperationCount before = OperationCount.Of(lambda);
+            lambda = LinqOptimizer.Optimize(lambda);
+            Log.WriteLine(MessageType.Verbose, "Process operations: {0} -> {1}", before, OperationCount.Of(lambda));
+
+            if (result.ApproximationError > 0.0)
+            {
+                lambda = FastMath.Approximate(lambda, result.ApproximationError, out int approximated);
+                Log.WriteLine(MessageType.Verbose, "Approximated {0} exp/log/pow calls (error < {1}).", approximated, result.ApproximationError);
+            }
+            result.Operations = OperationCount.Of(lambda);
+            result.Run = lambda.Compile();
+            return result;
         }
 
         // Solve a system of linear equations
-        private static void Solve(CodeGen code, LinqExpr Ab, IEnumerable<LinearCombination> Equations, IEnumerable<Expression> Unknowns)
+        private static void Solve(CodeGen code, LinqExpr Ab, int Stride, IEnumerable<LinearCombination> Equations, IEnumerable<Expression> Unknowns)
         {
             LinearCombination[] eqs = Equations.ToArray();
             Expression[] deltas = Unknowns.ToArray();
@@ -422,38 +713,44 @@ private static void Solve(CodeGen code, LinqExpr Ab, IEnumerable<LinearCombinati
             int M = eqs.Length;
             int N = deltas.Length;
 
+            // Ab[i][x] is Ab[i + x * Stride].
+            Func<int, int, LinqExpr> element = (i, x) => LinqExpr.ArrayAccess(Ab, LinqExpr.Constant(i + x * Stride));
+
             // Initialize the matrix.
             for (int i = 0; i < M; ++i)
             {
-                LinqExpr Abi = code.ReDeclInit<double[]>("Abi", LinqExpr.ArrayAccess(Ab, LinqExpr.Constant(i)));
                 for (int x = 0; x < N; ++x)
-                    code.Add(LinqExpr.Assign(
-                        LinqExpr.ArrayAccess(Abi, LinqExpr.Constant(x)),
-                        code.Compile(eqs[i][deltas[x]])));
-                code.Add(LinqExpr.Assign(
-                    LinqExpr.ArrayAccess(Abi, LinqExpr.Constant(N)),
-                    code.Compile(eqs[i][1])));
+                    code.Add(LinqExpr.Assign(element(i, x), code.Compile(eqs[i][deltas[x]])));
+                code.Add(LinqExpr.Assign(element(i, N), code.Compile(eqs[i][1])));
             }
             // In case we have fewer equations than unknowns, we can avoid dumb failures to converge by just
             // avoiding "uninitialized" memory left over in the buffer from previous solutions.
             for (int i = M; i < N; ++i)
-            {
-                LinqExpr Abi = code.ReDeclInit<double[]>("Abi", LinqExpr.ArrayAccess(Ab, LinqExpr.Constant(i)));
-                code.Add(LinqExpr.Assign(
-                    LinqExpr.ArrayAccess(Abi, LinqExpr.Constant(N)), 
-                    LinqExpr.Constant(0.0)));
-            }
+                code.Add(LinqExpr.Assign(element(i, N), LinqExpr.Constant(0.0)));
 
-            // Fully solve this system of equations.
+            // Fully solve this system of equations. The vectorized elimination only pays off when a column
+            // fills at least two vectors, smaller systems are faster with the scalar loops.
+            bool vectorize = Vector.IsHardwareAccelerated && M >= 2 * Vector<double>.Count;
             code.Add(LinqExpr.Call(
-                GetMethod<Simulation>(Vector.IsHardwareAccelerated ? nameof(SolveVector) : nameof(Solve), Ab.Type, typeof(int), typeof(int)),
+                GetMethod<Simulation>(vectorize ? nameof(SolveColumnMajorVector) : nameof(SolveColumnMajor), typeof(double[]), typeof(int), typeof(int), typeof(int)),
                 Ab,
                 LinqExpr.Constant(M),
-                LinqExpr.Constant(N + 1)));
+                LinqExpr.Constant(N + 1),
+                LinqExpr.Constant(Stride)));
 
             // Extract the solutions.
             for (int j = 0; j < N; ++j)
-                code.DeclInit(deltas[j], LinqExpr.Negate(LinqExpr.ArrayAccess(LinqExpr.ArrayAccess(Ab, LinqExpr.Constant(j)), LinqExpr.Constant(N))));
+                code.DeclInit(deltas[j], LinqExpr.Negate(element(j, N)));
+        }
+
+        /// <summary>
+        /// Distance between the columns of a flat column-major matrix with M rows, for SolveColumnMajor
+        /// and SolveColumnMajorVector. Columns start on a whole number of vectors.
+        /// </summary>
+        public static int SolveStride(int M)
+        {
+            int vectorLength = Vector<double>.Count;
+            return (M + vectorLength - 1) / vectorLength * vectorLength;
         }
 
         // A human readable implementation of RowReduce.
@@ -510,64 +807,138 @@ public static void Solve(double[][] Ab, int M, int N)
             }
         }
 
-        //This algorith has no tail-loop - it requires arrays to be padded to N + Vector.Count - 1
-        private static void SolveVector(double[][] Ab, int M, int N)
+        /// <summary>
+        /// Solve the system with augmented matrix Ab, the same as Solve(double[][], int, int). Ab is a flat
+        /// column-major matrix: element (i, x) is Ab[i + x * Stride]. Column N (after the augmented
+        /// column) is scratch space, so Ab must hold (N + 1) * Stride elements.
+        /// </summary>
+        public static void SolveColumnMajor(double[] Ab, int M, int N, int Stride)
         {
-            var vectorLength = Vector<double>.Count;
+            int end = N * Stride;
+            int s = end;
 
-            // Solve for dx.
-            // For each variable in the system...
+            // For each column...
             for (int j = 0; j < Math.Min(M, N); ++j)
             {
+                int cj = j * Stride;
                 int pi = j;
-                double max = Math.Abs(Ab[j][j]);
+                double max = Math.Abs(Ab[cj + j]);
 
                 // Find a pivot row for this variable.
                 for (int i = j + 1; i < M; ++i)
                 {
-                    // if(|JxF[i][j]| > max) { pi = i, max = |JxF[i][j]| }
-                    double maxj = Math.Abs(Ab[i][j]);
-                    if (maxj > max)
+                    double maxi = Math.Abs(Ab[cj + i]);
+                    if (maxi > max)
                     {
                         pi = i;
-                        max = maxj;
+                        max = maxi;
                     }
                 }
 
-                // Swap pivot row with the current row.
+                // Swap pivot row with the current row. The columns before j are no longer used.
                 if (pi != j)
                 {
-                    var tmp = Ab[pi];
-                    Ab[pi] = Ab[j];
-                    Ab[j] = tmp;
+                    for (int c = cj; c < end; c += Stride)
+                    {
+                        double tmp = Ab[c + pi];
+                        Ab[c + pi] = Ab[c + j];
+                        Ab[c + j] = tmp;
+                    }
                 }
 
-                double[] Abj = Ab[j];
-
-                // Eliminate all other rows.
-                double p = Abj[j];
+                double p = Ab[cj + j];
                 if (p == 0) continue;
+
+                // Multipliers of the other rows.
                 for (int i = 0; i < M; ++i)
+                    Ab[s + i] = Ab[cj + i] / p;
+                Ab[s + j] = 0.0;
+
+                // Eliminate all other rows, one column at a time.
+                for (int c = cj + Stride; c < end; c += Stride)
                 {
-                    if (i == j) continue;
-                    double[] Abi = Ab[i];
-                    if (Abi[j] == 0) continue;
+                    double a = Ab[c + j];
+                    if (a == 0.0) continue;
+                    for (int i = 0; i < M; ++i)
+                        Ab[c + i] -= Ab[s + i] * a;
+                }
 
-                    double s = Abi[j] / p;
-                    for (int ij = j + 1; ij < N; ij += vectorLength)
+                // Scale the pivot row, so the pivot is one.
+                double inv_p = 1.0 / p;
+                for (int c = cj + Stride; c < end; c += Stride)
+                    Ab[c + j] *= inv_p;
+            }
+        }
+
+        /// <summary>
+        /// SolveColumnMajor, eliminating Vector&lt;double&gt;.Count rows at a time. Stride must be a multiple
+        /// of the vector length, see SolveStride.
+        /// </summary>
+        public static void SolveColumnMajorVector(double[] Ab, int M, int N, int Stride)
+        {
+            int vectorLength = Vector<double>.Count;
+            // Rows rounded up to whole vectors, the rows after M have zero multipliers.
+            int rows = (M + vectorLength - 1) / vectorLength * vectorLength;
+            int end = N * Stride;
+            int s = end;
+
+            // For each column...
+            for (int j = 0; j < Math.Min(M, N); ++j)
+            {
+                int cj = j * Stride;
+                int pi = j;
+                double max = Math.Abs(Ab[cj + j]);
+
+                // Find a pivot row for this variable.
+                for (int i = j + 1; i < M; ++i)
+                {
+                    double maxi = Math.Abs(Ab[cj + i]);
+                    if (maxi > max)
                     {
-                        var source = new Vector<double>(Abj, ij);
-                        var target = new Vector<double>(Abi, ij);
-                        var res = target - (source * s);
-                        res.CopyTo(Abi, ij);
+                        pi = i;
+                        max = maxi;
+                    }
+                }
+
+                // Swap pivot row with the current row. The columns before j are no longer used.
+                if (pi != j)
+                {
+                    for (int c = cj; c < end; c += Stride)
+                    {
+                        double tmp = Ab[c + pi];
+                        Ab[c + pi] = Ab[c + j];
+                        Ab[c + j] = tmp;
+                    }
+                }
+
+                double p = Ab[cj + j];
+                if (p == 0) continue;
+
+                // Multipliers of the other rows.
+                Vector<double> vp = new Vector<double>(p);
+                for (int i = 0; i < rows; i += vectorLength)
+                    (new Vector<double>(Ab, cj + i) / vp).CopyTo(Ab, s + i);
+                for (int i = M; i < rows; ++i)
+                    Ab[s + i] = 0.0;
+                Ab[s + j] = 0.0;
+
+                // Eliminate all other rows, one column at a time.
+                for (int c = cj + Stride; c < end; c += Stride)
+                {
+                    double a = Ab[c + j];
+                    if (a == 0.0) continue;
+                    for (int i = 0; i < rows; i += vectorLength)
+                    {
+                        var target = new Vector<double>(Ab, c + i);
+                        var source = new Vector<double>(Ab, s + i);
+                        (target - source * a).CopyTo(Ab, c + i);
                     }
                 }
 
                 // Scale the pivot row, so the pivot is one.
-                // TODO: Vectorize
                 double inv_p = 1.0 / p;
-                for (int ij = j + 1; ij < N; ++ij)
-                    Abj[ij] *= inv_p;
+                for (int c = cj + Stride; c < end; c += Stride)
+                    Ab[c + j] *= inv_p;
             }
         }
 
@@ -620,6 +991,13 @@ private static LinqExpr IsNotReal(LinqExpr x)
                 LinqExpr.Call(GetMethod(x.Type, "IsInfinity", x.Type), x));
         }
         // Round x to zero if it is sub-normal.
-        private static LinqExpr RoundDenormToZero(LinqExpr x) { return x; }
+        private static LinqExpr RoundDenormToZero(LinqExpr x)
+        {
+            double min = x.Type == typeof(float) ? 1.17549435E-38 : 2.2250738585072014E-308;
+            return LinqExpr.Condition(
+                LinqExpr.LessThan(Abs(x), ConstantExpr(min, x.Type)),
+                ConstantExpr(0.0, x.Type),
+                x);
+        }
     }
 }
@@ -0,0 +1,288 @@
+﻿using ComputerAlgebra;
+using System;
+using System.Collections.Generic;
+using System.IO;
+using System.Linq;
+using System.Security.Cryptography;
+using System.Text;
+using System.Xml.Linq;
+using Util;
+
+namespace Circuit
+{
+    /// <summary>
+    /// Persistent cache of transient solutions on disk. Solutions are keyed by a hash of the serialized
+    /// circuit (its components, their models and connections) and the parameters of the solve, so loading
+    /// a circuit that was solved before skips the symbolic solution.
+    /// </summary>
+    public class SolutionCache
+    {
+        // Change this when the file format changes, to invalidate existing entries. Changes to the
+        // solver invalidate them through TransientSolution.SolverVersion.
+        private const int Version = 2;
+
+        private string directory;
+        /// <summary>
+        /// Directory the solutions are stored in.
+        /// </summary>
+        public string Directory { get { return directory; } }
+
+        private int capacity = 256;
+        /// <summary>
+        /// Number of solutions to keep. Adding a solution removes the least recently used ones beyond this.
+        /// </summary>
+        public int Capacity { get { return capacity; } set { capacity = value; } }
+
+        public SolutionCache(string Directory) { directory = Directory; }
+
+        private static Lazy<SolutionCache> global = new Lazy<SolutionCache>(() => new SolutionCache(Path.Combine(
+            Environment.GetFolderPath(Environment.SpecialFolder.LocalApplicationData),
+            "LiveSPICE",
+            "Solutions")));
+        /// <summary>
+        /// Cache shared by the LiveSPICE applications and tools, in the local application data of the user.
+        /// </summary>
+        public static SolutionCache Global
+        {
+            get { return global.Value; }
+            set { SolutionCache cache = value; global = new Lazy<SolutionCache>(() => cache); }
+        }
+
+        /// <summary>
+        /// Get the solution of a circuit from the cache, or analyze and solve the circuit and add it.
+        /// </summary>
+        /// <param name="Circuit">Circuit to solve.</param>
+        /// <param name="TimeStep">Discretization timestep.</param>
+        /// <param name="Parametric">Analyze the controls as parameters, see Circuit.Analyze.</param>
+        /// <param name="Log">Where to send output.</param>
+        /// <returns>TransientSolution describing the solution of the circuit.</returns>
+        public TransientSolution Solve(Circuit Circuit, Expression TimeStep, bool Parametric, ILog Log)
+        {
+            string key = Key(Circuit, TimeStep, Parametric);
+            string path = Path.Combine(directory, key + ".xml");
+
+            if (File.Exists(path))
+            {
+                try
+                {
+                    TransientSolution cached = Read(XElement.Load(path), Parametric ? Circuit.Analyze(true).Parameters : new Parameter[] { });
+                    Touch(path);
+                    Log.WriteLine(MessageType.Info, "Loaded solution from cache '{0}'", path);
+                    return cached;
+                }
+                catch (Exception Ex)
+                {
+                    Log.WriteLine(MessageType.Warning, "Failed to load cached solution '{0}': {1}", path, Ex.Message);
+                }
+            }
+
+            Analysis analysis = Circuit.Analyze(Parametric);
+            TransientSolution solution = TransientSolution.Solve(analysis, TimeStep, Log);
+
+            try
+            {
+                // Only cache solutions that are read back exactly as they were solved.
+                XElement X = Write(solution);
+                if (SameSolution(solution, Read(X, analysis.Parameters)))
+                {
+                    System.IO.Directory.CreateDirectory(directory);
+                    // Write to a temporary file first, so a concurrent reader never sees a partial entry.
+                    string temp = path + "." + Guid.NewGuid().ToString("N") + ".tmp";
+                    X.Save(temp);
+                    if (File.Exists(path))
+                        File.Delete(temp);
+                    else
+                        File.Move(temp, path);
+                    Trim();
+                }
+                else
+                {
+                    Log.WriteLine(MessageType.Verbose, "Solution does not round trip through text, not cached.");
+                }
+            }
+            catch (Exception Ex)
+            {
+                Log.WriteLine(MessageType.Warning, "Failed to cache solution: {0}", Ex.Message);
+            }
+            return solution;
+        }
+        public TransientSolution Solve(Circuit Circuit, Expression TimeStep, ILog Log) { return Solve(Circuit, TimeStep, false, Log); }
+        public TransientSolution Solve(Circuit Circuit, Expression TimeStep) { return Solve(Circuit, TimeStep, false, new NullLog()); }
+
+        /// <summary>
+        /// Remove all of the cached solutions.
+        /// </summary>
+        public void Clear()
+        {
+            if (System.IO.Directory.Exists(directory))
+                foreach (string i in System.IO.Directory.GetFiles(directory, "*.xml"))
+                    File.Delete(i);
+        }
+
+        // Mark an entry as used. The write time orders the entries by use, for Trim.
+        private static void Touch(string Path)
+        {
+            try
+            {
+                File.SetLastWriteTimeUtc(Path, DateTime.UtcNow);
+            }
+            catch (Exception)
+            {
+                // The entry is still valid, it is just trimmed earlier.
+            }
+        }
+
+        // Remove the least recently used solutions beyond the capacity of the cache.
+        private void Trim()
+        {
+            FileInfo[] entries = new DirectoryInfo(directory).GetFiles("*.xml");
+            foreach (FileInfo i in entries.OrderByDescending(i => i.LastWriteTimeUtc).Skip(capacity))
+            {
+                try
+                {
+                    i.Delete();
+                }
+                catch (IOException)
+                {
+                    // Another process may be using or removing it, it is trimmed next time.
+                }
+            }
+        }
+
+        /// <summary>
+        /// Hash identifying the solution of a circuit.
+        /// </summary>
+        public static string Key(Circuit Circuit, Expression TimeStep, bool Parametric)
+        {
+            StringBuilder key = new StringBuilder();
+            key.AppendLine(Version.ToString());
+            key.AppendLine(TransientSolution.SolverVersion.ToString());
+            key.AppendLine(TimeStep.ToString());
+            key.AppendLine(Parametric.ToString());
+            key.Append(Circuit.Serialize().ToString(SaveOptions.DisableFormatting));
+
+            using (SHA256 sha = SHA256.Create())
+                return string.Concat(sha.ComputeHash(Encoding.UTF8.GetBytes(key.ToString())).Select(i => i.ToString("x2")));
+        }
+
+        // Serialization of the solution, with each expression written as text.
+        private static XElement Write(TransientSolution S)
+        {
+            XElement X = new XElement("TransientSolution", new XAttribute("TimeStep", S.TimeStep));
+            foreach (SolutionSet i in S.Solutions)
+            {
+                if (i is LinearSolutions linear)
+                {
+                    X.Add(new XElement("LinearSolutions", Write("Solution", linear.Solutions)));
+                }
+                else if (i is NewtonIteration newton)
+                {
+                    X.Add(new XElement("NewtonIteration",
+                        Write("KnownDelta", newton.KnownDeltas ?? new Arrow[] { }),
+                        newton.Equations.Select(j => new XElement("Equation", j.Select(k =>
+                            new XElement("Term", new XAttribute("Key", k.Key), new XAttribute("Value", k.Value))))),
+                        newton.UnknownDeltas.Select(j => new XElement("UnknownDelta", new XAttribute("Value", j))),
+                        Write("Guess", newton.Guesses)));
+                }
+                else
+                {
+                    throw new NotSupportedException("Solution set " + i.GetType().Name);
+                }
+            }
+            X.Add(Write("InitialCondition", S.InitialConditions));
+            X.Add(S.Parameters.Select(i => new XElement("Parameter", new XAttribute("Name", i.Name), new XAttribute("Variable", i.Variable))));
+            return X;
+        }
+
+        private static IEnumerable<XElement> Write(string Name, IEnumerable<Arrow> Arrows)
+        {
+            return Arrows.Select(i => new XElement(Name, new XAttribute("Left", i.Left), new XAttribute("Right", i.Right))).ToList();
+        }
+
+        // The parameters of the solution are found by name (component and property) among the
+        // parameters of the circuit.
+        private static TransientSolution Read(XElement X, IEnumerable<Parameter> Parameters)
+        {
+            List<SolutionSet> solutions = new List<SolutionSet>();
+            foreach (XElement i in X.Elements())
+            {
+                if (i.Name == "LinearSolutions")
+                {
+                    solutions.Add(new LinearSolutions(Read(i, "Solution")));
+                }
+                else if (i.Name == "NewtonIteration")
+                {
+                    solutions.Add(new NewtonIteration(
+                        Read(i, "KnownDelta"),
+                        i.Elements("Equation").Select(j => LinearCombination.New(j.Elements("Term").Select(k =>
+                            new KeyValuePair<Expression, Expression>(Parse(k, "Key"), Parse(k, "Value"))))).ToList(),
+                        i.Elements("UnknownDelta").Select(j => Parse(j, "Value")).ToList(),
+                        Read(i, "Guess")));
+                }
+            }
+
+            List<Parameter> parameters = new List<Parameter>();
+            foreach (XElement i in X.Elements("Parameter"))
+            {
+                string name = i.Attribute("Name").Value;
+                Parameter parameter = Parameters.FirstOrDefault(j => j.Name == name);
+                if (parameter == null)
+                    throw new InvalidDataException("Unknown parameter '" + name + "'.");
+                if (!parameter.Variable.Equals(Parse(i, "Variable")))
+                    throw new InvalidDataException("Parameter '" + name + "' is not '" + i.Attribute("Variable").Value + "'.");
+                parameters.Add(parameter);
+            }
+
+            return new TransientSolution(Parse(X, "TimeStep"), solutions, Read(X, "InitialCondition"), parameters);
+        }
+
+        private static List<Arrow> Read(XElement X, string Name)
+        {
+            return X.Elements(Name).Select(i => Arrow.New(Parse(i, "Left"), Parse(i, "Right"))).ToList();
+        }
+
+        private static Expression Parse(XElement X, string Attribute)
+        {
+            return Expression.Parse(X.Attribute(Attribute).Value);
+        }
+
+        // Check that two solutions are the same, expression by expression.
+        private static bool SameSolution(TransientSolution A, TransientSolution B)
+        {
+            if (!A.TimeStep.Equals(B.TimeStep) || !A.InitialConditions.SequenceEqual(B.InitialConditions))
+                return false;
+            if (!A.Parameters.Select(i => i.Variable).SequenceEqual(B.Parameters.Select(i => i.Variable)))
+                return false;
+
+            List<SolutionSet> a = A.Solutions.ToList();
+            List<SolutionSet> b = B.Solutions.ToList();
+            if (a.Count != b.Count)
+                return false;
+            for (int i = 0; i < a.Count; ++i)
+            {
+                if (a[i] is LinearSolutions la && b[i] is LinearSolutions lb)
+                {
+                    if (!la.Solutions.SequenceEqual(lb.Solutions))
+                        return false;
+                }
+                else if (a[i] is NewtonIteration na && b[i] is NewtonIteration nb)
+                {
+                    if (!(na.KnownDeltas ?? new Arrow[] { }).SequenceEqual(nb.KnownDeltas ?? new Arrow[] { }) ||
+                        !na.UnknownDeltas.SequenceEqual(nb.UnknownDeltas) ||
+                        !na.Guesses.SequenceEqual(nb.Guesses) ||
+                        !na.Unknowns.SequenceEqual(nb.Unknowns))
+                        return false;
+                    List<LinearCombination> ea = na.Equations.ToList();
+                    List<LinearCombination> eb = nb.Equations.ToList();
+                    if (ea.Count != eb.Count || ea.Zip(eb, (x, y) => x.SequenceEqual(y)).Any(j => !j))
+                        return false;
+                }
+                else
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+    }
+}
@@ -2,6 +2,8 @@
 using System;
 using System.Collections.Generic;
 using System.Linq;
+using System.Runtime.ExceptionServices;
+using System.Threading.Tasks;
 using Util;
 
 namespace Circuit
@@ -14,6 +16,12 @@ public class TransientSolution
         public static readonly Variable t = Component.t;
         public static readonly Expression T = Component.T;
 
+        /// <summary>
+        /// Version of the solver. Increment this when a change to Solve changes the solution it finds
+        /// for a circuit, so solutions stored by an older solver (see SolutionCache) are not used.
+        /// </summary>
+        public const int SolverVersion = 1;
+
         private Expression h;
         /// <summary>
         /// The length of a timestep given by this solution.
@@ -33,6 +41,12 @@ public class TransientSolution
         /// </summary>
         public IEnumerable<Arrow> InitialConditions { get { return initialConditions; } }
 
+        private IEnumerable<Parameter> parameters;
+        /// <summary>
+        /// Parameters the solution depends on, which can be changed without solving again.
+        /// </summary>
+        public IEnumerable<Parameter> Parameters { get { return parameters; } }
+
         /// <summary>
         /// 
         /// </summary>
@@ -43,12 +57,19 @@ public class TransientSolution
         public TransientSolution(
             Expression TimeStep,
             IEnumerable<SolutionSet> Solutions,
-            IEnumerable<Arrow> InitialConditions)
+            IEnumerable<Arrow> InitialConditions,
+            IEnumerable<Parameter> Parameters)
         {
             h = TimeStep;
             solutions = Solutions.Buffer();
             initialConditions = InitialConditions.Buffer();
+            parameters = Parameters.Buffer();
         }
+        public TransientSolution(
+            Expression TimeStep,
+            IEnumerable<SolutionSet> Solutions,
+            IEnumerable<Arrow> InitialConditions)
+            : this(TimeStep, Solutions, InitialConditions, new Parameter[] { }) { }
 
         /// <summary>
         /// Check if any of the SolutionSets in this solution depend on x.
@@ -63,8 +84,11 @@ public class TransientSolution
         /// <param name="Analysis">Analysis from the circuit to solve.</param>
         /// <param name="TimeStep">Discretization timestep.</param>
         /// <param name="Log">Where to send output.</param>
+        /// <param name="EliminateLinear">Solve the unknowns the system is affine in after the Newton iterations, instead of in them.</param>
+        /// <param name="MaxDegreeOfParallelism">Maximum number of independent systems solved at once, -1 for no limit. By default the systems are
+        /// solved in sequence, see SolveAll for why.</param>
         /// <returns>TransientSolution describing the solution of the circuit.</returns>
-        public static TransientSolution Solve(Analysis Analysis, Expression TimeStep, IEnumerable<Arrow> InitialConditions, ILog Log)
+        public static TransientSolution Solve(Analysis Analysis, Expression TimeStep, IEnumerable<Arrow> InitialConditions, ILog Log, bool EliminateLinear = true, int MaxDegreeOfParallelism = 1)
         {
             Expression h = TimeStep;
 
@@ -96,29 +120,23 @@ public static TransientSolution Solve(Analysis Analysis, Expression TimeStep, IE
             LogExpressions(Log, MessageType.Verbose, "Initial conditions for solve:", initial);
             LogExpressions(Log, MessageType.Verbose, "Initial conditions from analysis:", Analysis.InitialConditions);
 
+            // The steady state is found numerically, at the current values of the parameters.
+            List<Arrow> parameters = Analysis.Parameters.Select(i => Arrow.New(i.Variable, i.Value)).ToList();
+            if (parameters.Any())
+                LogExpressions(Log, MessageType.Verbose, "Parameters:", parameters);
+
             SystemOfEquations dc = new SystemOfEquations(mna
                 // Derivatives, t, and T are zero in the steady state.
                 .Substitute(dy_dt.Select(i => Arrow.New(i, 0)).Append(Arrow.New(t, 0), Arrow.New(T, 0), SinglePoleSwitch.IncludeOpen))
+                .Substitute(parameters)
                 // Use the initial conditions from analysis.
                 .Substitute(Analysis.InitialConditions)
                 // Evaluate variables at t=0.
                 .OfType<Equal>(), y.Select(j => j.Substitute(t, 0)));
 
             // Solve partitions independently.
-            foreach (SystemOfEquations i in dc.Partition())
-            {
-                LogExpressions(Log, MessageType.Verbose, "Steady state system for partition:", i.Select(j => Equal.New(j, 0)));
-                try
-                {
-                    List<Arrow> part = i.Equations.Select(j => Equal.New(j, 0)).NSolve(i.Unknowns.Select(j => Arrow.New(j, 0)));
-                    initial.AddRange(part);
-                    LogExpressions(Log, MessageType.Verbose, "Initial conditions:", part); 
-                }
-                catch (Exception)
-                {
-                    Log.WriteLine(MessageType.Warning, "Failed to find partition initial conditions, simulation may be unstable.");
-                }
-            }
+            foreach (List<Arrow> part in SolveAll(dc.Partition().ToList(), SolveSteadyState, Log, MaxDegreeOfParallelism))
+                initial.AddRange(part);
 
             // Transient analysis of the system.
             Log.WriteLine(MessageType.Info, "Performing transient analysis...");
@@ -140,57 +158,31 @@ public static TransientSolution Solve(Analysis Analysis, Expression TimeStep, IE
             if (system.DependsOn(dy_dt))
                 throw new Exception("Failed to eliminate differentials from system of equations.");
 
-            // Solving the system...
-            List<SolutionSet> solutions = new List<SolutionSet>();
-
-            // Partition the system into independent systems of equations.
-            foreach (SystemOfEquations F in system.Partition())
+            // Partition the system into independent systems of equations, and split each partition
+            // into blocks that can be solved one after another, so each Newton iteration only
+            // includes unknowns that are actually coupled.
+            //
+            // Linear blocks become LinearSolutions, but they are still discretized with h and run at
+            // the oversampled rate with the rest of the circuit. Running them at the base rate, as
+            // state-space or biquad sections, would need a second discretization of those blocks and
+            // a resampler between the partitions, which is not done yet.
+            List<SystemOfEquations> blocks = new List<SystemOfEquations>();
+            foreach (SystemOfEquations P in system.Partition())
             {
-                Log.WriteLine(MessageType.Verbose, "Partition unknowns: {0}", String.Join(", ", F.Unknowns));
-                // Find linear solutions for y. Linear systems should be completely solved here.
-                F.RowReduce();
-                IEnumerable<Arrow> linear = F.Solve();
-                if (linear.Any())
-                {
-                    linear = Factor(linear);
-                    solutions.Add(new LinearSolutions(linear));
-                    LogExpressions(Log, MessageType.Verbose, "Linear solutions:", linear);
-                }
+                List<SystemOfEquations> sequential = SequentialBlocks(P);
+                if (sequential.Count > 1)
+                    Log.WriteLine(MessageType.Verbose, "Partition split into {0} sequential blocks of {1} unknowns", sequential.Count, String.Join(", ", sequential.Select(i => i.Unknowns.Count())));
 
-                // If there are any variables left, there are some non-linear equations requiring numerical techniques to solve.
-                if (F.Unknowns.Any())
-                {
-                    // The variables of this system are the newton iteration updates.
-                    List<Expression> dy = F.Unknowns.Select(i => NewtonIteration.Delta(i)).ToList();
-
-                    // Compute JxF*dy + F(y0) == 0.
-                    SystemOfEquations nonlinear = new SystemOfEquations(
-                        F.Select(i => i.Gradient(F.Unknowns).Select(j => new KeyValuePair<Expression, Expression>(NewtonIteration.Delta(j.Key), j.Value))
-                            .Append(new KeyValuePair<Expression, Expression>(1, i))),
-                        dy);
-
-                    // ly is the subset of y that can be found linearly.
-                    List<Expression> ly = dy.Where(j => !nonlinear.Any(i => i[j].DependsOn(NewtonIteration.DeltaOf(j)))).ToList();
-
-                    // Find linear solutions for dy. 
-                    nonlinear.RowReduce(ly);
-                    IEnumerable<Arrow> solved = nonlinear.Solve(ly);
-                    solved = Factor(solved);
-
-                    // Initial guess for y[t] = y[t - h].
-                    IEnumerable<Arrow> guess = F.Unknowns.Select(i => Arrow.New(i, i.Substitute(t, t - h))).ToList();
-                    guess = Factor(guess);
-
-                    // Newton system equations.
-                    IEnumerable<LinearCombination> equations = nonlinear.Equations.Buffer();
-                    equations = Factor(equations);
-
-                    solutions.Add(new NewtonIteration(solved, equations, nonlinear.Unknowns, guess));
-                    LogExpressions(Log, MessageType.Verbose, String.Format("Non-linear Newton's method updates ({0}):", String.Join(", ", nonlinear.Unknowns)), equations.Select(i => Equal.New(i, 0)));
-                    LogExpressions(Log, MessageType.Verbose, "Linear Newton's method updates:", solved);
-                }
+                // The solutions are reversed below, so add the last block first.
+                sequential.Reverse();
+                blocks.AddRange(sequential);
             }
 
+            // The blocks only depend on each other numerically, so they can be solved symbolically in any order.
+            List<SolutionSet> solutions = SolveAll(blocks, (F, log) => SolveBlock(F, h, EliminateLinear, log), Log, MaxDegreeOfParallelism)
+                .SelectMany(i => i)
+                .ToList();
+
             Log.WriteLine(MessageType.Info, "System solved, {0} solution sets for {1} unknowns.",
                 solutions.Count,
                 solutions.Sum(i => i.Unknowns.Count()));
@@ -201,11 +193,238 @@ public static TransientSolution Solve(Analysis Analysis, Expression TimeStep, IE
             return new TransientSolution(
                 h,
                 solutions,
-                initial);
+                initial,
+                Analysis.Parameters);
         }
         public static TransientSolution Solve(Analysis Analysis, Expression TimeStep, ILog Log) { return Solve(Analysis, TimeStep, new Arrow[] { }, Log); }
         public static TransientSolution Solve(Analysis Analysis, Expression TimeStep) { return Solve(Analysis, TimeStep, new Arrow[] { }, new NullLog()); }
 
+        // Solve one block of the transient system symbolically, giving the solution sets in the order they were found.
+        private static List<SolutionSet> SolveBlock(SystemOfEquations F, Expression h, bool EliminateLinear, ILog Log)
+        {
+            List<SolutionSet> result = new List<SolutionSet>();
+            Log.WriteLine(MessageType.Verbose, "Partition unknowns: {0}", String.Join(", ", F.Unknowns));
+            // Find linear solutions for y. Linear systems should be completely solved here.
+            F.RowReduce();
+            IEnumerable<Arrow> linear = F.Solve();
+            if (linear.Any())
+            {
+                linear = Factor(linear);
+                result.Add(new LinearSolutions(linear));
+                LogExpressions(Log, MessageType.Verbose, "Linear solutions:", linear);
+            }
+
+            // The system is affine in the unknowns none of the Jacobian entries depend on. Those
+            // are eliminated here (the K-method), so the Newton iterations only run over the
+            // unknowns of the nonlinear devices; the rest are found once Newton converges.
+            if (EliminateLinear && F.Unknowns.Any())
+            {
+                List<Expression> affine = AffineUnknowns(F);
+                if (affine.Any())
+                {
+                    int before = F.Unknowns.Count();
+                    F.RowReduce(affine);
+                    IEnumerable<Arrow> eliminated = F.Solve(affine);
+                    if (eliminated.Any())
+                    {
+                        eliminated = Factor(eliminated);
+                        result.Add(new LinearSolutions(eliminated));
+                        Log.WriteLine(MessageType.Verbose, "Eliminated {0} of {1} unknowns from the Newton iteration", eliminated.Count(), before);
+                        LogExpressions(Log, MessageType.Verbose, "Eliminated solutions:", eliminated);
+                    }
+                }
+            }
+
+            // If there are any variables left, there are some non-linear equations requiring numerical techniques to solve.
+            if (F.Unknowns.Any())
+            {
+                // The variables of this system are the newton iteration updates.
+                List<Expression> dy = F.Unknowns.Select(i => NewtonIteration.Delta(i)).ToList();
+
+                // Compute JxF*dy + F(y0) == 0.
+                SystemOfEquations nonlinear = new SystemOfEquations(
+                    F.Select(i => i.Gradient(F.Unknowns).Select(j => new KeyValuePair<Expression, Expression>(NewtonIteration.Delta(j.Key), j.Value))
+                        .Append(new KeyValuePair<Expression, Expression>(1, i))),
+                    dy);
+
+                // ly is the subset of y that can be found linearly.
+                List<Expression> ly = dy.Where(j => !nonlinear.Any(i => i[j].DependsOn(NewtonIteration.DeltaOf(j)))).ToList();
+
+                // Find linear solutions for dy. 
+                nonlinear.RowReduce(ly);
+                IEnumerable<Arrow> solved = nonlinear.Solve(ly);
+                solved = Factor(solved);
+
+                // Initial guess for y[t] = y[t - h].
+                IEnumerable<Arrow> guess = F.Unknowns.Select(i => Arrow.New(i, i.Substitute(t, t - h))).ToList();
+                guess = Factor(guess);
+
+                // Newton system equations.
+                IEnumerable<LinearCombination> equations = nonlinear.Equations.Buffer();
+                equations = Factor(equations);
+
+                result.Add(new NewtonIteration(solved, equations, nonlinear.Unknowns, guess));
+                LogExpressions(Log, MessageType.Verbose, String.Format("Non-linear Newton's method updates ({0}):", String.Join(", ", nonlinear.Unknowns)), equations.Select(i => Equal.New(i, 0)));
+                LogExpressions(Log, MessageType.Verbose, "Linear Newton's method updates:", solved);
+            }
+            return result;
+        }
+
+        // Find the steady state of one partition of the DC system numerically.
+        private static List<Arrow> SolveSteadyState(SystemOfEquations S, ILog Log)
+        {
+            LogExpressions(Log, MessageType.Verbose, "Steady state system for partition:", S.Select(j => Equal.New(j, 0)));
+            try
+            {
+                List<Arrow> part = S.Equations.Select(j => Equal.New(j, 0)).NSolve(S.Unknowns.Select(j => Arrow.New(j, 0)));
+                LogExpressions(Log, MessageType.Verbose, "Initial conditions:", part);
+                return part;
+            }
+            catch (Exception)
+            {
+                Log.WriteLine(MessageType.Warning, "Failed to find partition initial conditions, simulation may be unstable.");
+                return new List<Arrow>();
+            }
+        }
+
+        /// <summary>
+        /// Apply Solve to independent systems of equations in parallel. The thread pool balances the
+        /// systems across cores by work stealing. The results and log messages are in the order of
+        /// the systems, so the solution doesn't depend on the scheduling. If several systems fail, the
+        /// exception of the first one is thrown, as if they were solved in sequence.
+        ///
+        /// This is only used when the caller asks for it. The systems share nothing on this side, but
+        /// solving them calls into ComputerAlgebra (Solve, Factor, D, and the function lookups behind
+        /// them) from several threads at once, and ComputerAlgebra makes no thread safety guarantees.
+        /// Its calls have not been audited for shared state, so the load paths (SolutionCache,
+        /// LiveSPICE, the VST and ExportToC) solve in sequence until they are.
+        /// </summary>
+        private static List<T> SolveAll<T>(List<SystemOfEquations> Systems, Func<SystemOfEquations, ILog, T> Solve, ILog Log, int MaxDegreeOfParallelism)
+        {
+            if (Systems.Count < 2 || MaxDegreeOfParallelism == 1)
+                return Systems.Select(i => Solve(i, Log)).ToList();
+
+            T[] results = new T[Systems.Count];
+            Exception[] errors = new Exception[Systems.Count];
+            BufferedLog[] logs = Systems.Select(i => new BufferedLog()).ToArray();
+            Parallel.For(0, Systems.Count, new ParallelOptions() { MaxDegreeOfParallelism = MaxDegreeOfParallelism }, i =>
+            {
+                try
+                {
+                    results[i] = Solve(Systems[i], Log is NullLog ? Log : logs[i]);
+                }
+                catch (Exception Ex)
+                {
+                    errors[i] = Ex;
+                }
+            });
+            // Stop at the first failure, like the sequential solve.
+            for (int i = 0; i < Systems.Count; ++i)
+            {
+                logs[i].WriteTo(Log);
+                if (errors[i] != null)
+                    ExceptionDispatchInfo.Capture(errors[i]).Throw();
+            }
+            return results.ToList();
+        }
+
+        /// <summary>
+        /// Decompose F into blocks that can be solved in sequence: each block depends only on its
+        /// own unknowns and the unknowns of the blocks before it. For example, a clipping stage
+        /// driving another through a buffer becomes two smaller Newton iterations instead of one.
+        /// </summary>
+        /// <param name="F">System of equations to decompose.</param>
+        /// <returns>The blocks in the order they must be solved, or just F if all of its unknowns are coupled.</returns>
+        private static List<SystemOfEquations> SequentialBlocks(SystemOfEquations F)
+        {
+            List<Expression> eqs = F.Equations.ToList();
+            List<Expression> y = F.Unknowns.ToList();
+            if (eqs.Count != y.Count || y.Count < 2)
+                return new List<SystemOfEquations>() { F };
+
+            // The unknowns each equation depends on.
+            List<int>[] deps = eqs.Select(i => Enumerable.Range(0, y.Count).Where(j => i.DependsOn(y[j])).ToList()).ToArray();
+
+            // Match each unknown with an equation that determines it.
+            int[] matched = Enumerable.Repeat(-1, y.Count).ToArray();
+            for (int i = 0; i < eqs.Count; ++i)
+                if (!Augment(i, deps, matched, new bool[y.Count]))
+                    return new List<SystemOfEquations>() { F };
+
+            // An unknown needs the unknowns its equation depends on. The strongly connected
+            // components of this graph are the blocks, and are found in dependency order.
+            List<List<int>> components = new List<List<int>>();
+            int[] index = Enumerable.Repeat(-1, y.Count).ToArray();
+            int[] low = new int[y.Count];
+            Stack<int> stack = new Stack<int>();
+            int next = 0;
+            for (int j = 0; j < y.Count; ++j)
+                if (index[j] < 0)
+                    Connect(j, deps, matched, index, low, stack, ref next, components);
+
+            if (components.Count == 1)
+                return new List<SystemOfEquations>() { F };
+            return components.Select(i => new SystemOfEquations(
+                i.Select(j => Equal.New(eqs[matched[j]], 0)),
+                i.Select(j => y[j]))).ToList();
+        }
+
+        // Find an augmenting path for equation i in the bipartite equation-unknown graph.
+        private static bool Augment(int i, List<int>[] deps, int[] matched, bool[] visited)
+        {
+            foreach (int j in deps[i])
+            {
+                if (visited[j])
+                    continue;
+                visited[j] = true;
+                if (matched[j] < 0 || Augment(matched[j], deps, matched, visited))
+                {
+                    matched[j] = i;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        // Tarjan's strongly connected components, visiting the unknowns v needs.
+        private static void Connect(int v, List<int>[] deps, int[] matched, int[] index, int[] low, Stack<int> stack, ref int next, List<List<int>> components)
+        {
+            index[v] = low[v] = next++;
+            stack.Push(v);
+            foreach (int w in deps[matched[v]])
+            {
+                if (index[w] < 0)
+                {
+                    Connect(w, deps, matched, index, low, stack, ref next, components);
+                    low[v] = Math.Min(low[v], low[w]);
+                }
+                else if (stack.Contains(w))
+                {
+                    low[v] = Math.Min(low[v], index[w]);
+                }
+            }
+
+            if (low[v] == index[v])
+            {
+                List<int> component = new List<int>();
+                int u;
+                do
+                {
+                    u = stack.Pop();
+                    component.Add(u);
+                } while (u != v);
+                components.Add(component);
+            }
+        }
+
+        // Find the unknowns of F that none of the entries of its Jacobian depend on.
+        private static List<Expression> AffineUnknowns(SystemOfEquations F)
+        {
+            List<Expression> y = F.Unknowns.ToList();
+            List<Expression> J = F.SelectMany(i => i.Gradient(y).Select(j => j.Value)).ToList();
+            return y.Where(i => !J.Any(j => j.DependsOn(i))).ToList();
+        }
+
         private static IEnumerable<Arrow> Factor(IEnumerable<Arrow> x) { return x.Select(i => Arrow.New(i.Left, i.Right.Factor())).Buffer(); }
         private static IEnumerable<LinearCombination> Factor(IEnumerable<LinearCombination> x) { return x.Select(i => LinearCombination.New(i.Select(j => new KeyValuePair<Expression, Expression>(j.Key, j.Value.Factor())))).Buffer(); }
 
@@ -0,0 +1,244 @@
+/**
+ * Chain Backend
+ * Fuses several circuits in series into one kernel, oversampled from the input of the
+ * first circuit to the output of the last.
+ *
+ * This is a chain of the exporter's template: every stage is the same hard-coded
+ * drive/clip/tone stage as circuit_process, with the drive, tone and volume read from
+ * the potentiometers of its circuit. The circuits' own solutions are only used to find
+ * their parameters and for the cost report.
+ */
+
+using System;
+using System.Collections.Generic;
+using System.IO;
+using System.Linq;
+using System.Text;
+using Circuit;
+
+namespace LiveSPICEExport
+{
+    // One circuit of a chain, with its parameters in the fused parameter list.
+    class ChainStage
+    {
+        public string Name;
+        public Simulation Simulation;
+        public int FirstParameter;
+        public int Drive, Tone, Volume;
+        public List<string> Potentiometers;
+    }
+
+    partial class Program
+    {
+        static void ExportChain(List<string> inputFiles, string outputFile, int sampleRate, int bufferSize, int oversample, ExportOptions options, bool compileDylib)
+        {
+            if (options.Lanes != 0 || options.SinglePrecision || options.Resampling != Resampling.Linear || options.Adaptive || options.Cpp)
+            {
+                Console.WriteLine("Error: chained circuits only support the sample rate, buffer size and oversampling options");
+                return;
+            }
+
+            try
+            {
+                var stages = new List<ChainStage>();
+                var parameters = new List<string>();
+                var reports = new List<CostReport>();
+                foreach (string inputFile in inputFiles)
+                {
+                    Console.WriteLine($"Loading circuit {stages.Count + 1}: {inputFile}");
+                    var schematic = Schematic.Load(inputFile);
+                    var circuit = schematic.Build();
+                    Console.WriteLine($"Circuit built: {circuit.Components.Count} components, {circuit.Nodes.Count} nodes");
+
+                    Console.WriteLine("Analyzing circuit...");
+                    var stage = new ChainStage()
+                    {
+                        Name = circuit.Name ?? Path.GetFileNameWithoutExtension(inputFile),
+                        Simulation = CreateSimulation(circuit, sampleRate, oversample),
+                        FirstParameter = parameters.Count,
+                        Drive = FindPotentiometer("drive", "gain", "distortion"),
+                        Tone = FindPotentiometer("tone"),
+                        Volume = FindPotentiometer("vol", "level"),
+                        Potentiometers = potentiometerNames.ToList(),
+                    };
+                    stages.Add(stage);
+                    reports.Add(CostReport.Of(stage.Simulation, stage.Name, sampleRate, oversample));
+
+                    // Parameters are numbered by stage, e.g. "2:Drive" is the drive of the second circuit
+                    parameters.AddRange(stage.Potentiometers.Select(i => $"{stages.Count}:{i}"));
+                }
+
+                // The shared generators work on the fused parameter list
+                potentiometerNames.Clear();
+                potentiometerNames.AddRange(parameters);
+
+                // One report section per circuit
+                string reportFile = Path.ChangeExtension(outputFile, ".report.txt");
+                File.WriteAllText(reportFile, string.Join(Environment.NewLine, reports));
+                string summary = $"{stages.Count} circuits, ~{reports.Sum(i => i.CyclesPerSample(1)):F0} cycles/sample";
+                Console.WriteLine($"Cost report: {reportFile} ({summary})");
+
+                Console.WriteLine($"Exporting chain of {stages.Count} circuits to C: {outputFile}");
+                var sb = new StringBuilder();
+                GenerateChainCode(stages, sb, sampleRate, bufferSize, oversample, summary);
+                File.WriteAllText(outputFile, sb.ToString());
+                Console.WriteLine("Export complete!");
+
+                if (compileDylib)
+                    CompileToDylib(outputFile);
+            }
+            catch (Exception ex)
+            {
+                Console.WriteLine($"Error: {ex.Message}");
+                Console.WriteLine($"Stack trace: {ex.StackTrace}");
+            }
+        }
+
+        // Same stages as circuit_process for each circuit, run back to back inside one
+        // oversampling loop. Separately exported circuits would each average down to the host
+        // rate and hold back up again between stages; here the signal stays at the oversampled
+        // rate, and only the output of the last circuit is decimated and soft clipped.
+        static void GenerateChainCode(List<ChainStage> stages, StringBuilder sb, int sampleRate, int bufferSize, int oversample, string summary)
+        {
+            sb.AppendLine("/**");
+            sb.AppendLine(" * Auto-generated Circuit Simulation");
+            sb.AppendLine(" * Exported from LiveSPICE");
+            sb.AppendLine(" *");
+            sb.AppendLine(" * Chain of the drive/clip/tone template, one stage per circuit:");
+            for (int k = 0; k < stages.Count; k++)
+                sb.AppendLine($" *   {k + 1}. {stages[k].Name}");
+            sb.AppendLine(" */");
+            sb.AppendLine();
+            sb.AppendLine("#include <stdlib.h>");
+            sb.AppendLine("#include <string.h>");
+            sb.AppendLine("#include <math.h>");
+            sb.AppendLine();
+            GenerateDenormalControl(sb);
+            sb.AppendLine($"#define CIRCUIT_NUM_STAGES {stages.Count}");
+            sb.AppendLine();
+            sb.AppendLine("// Circuit context structure");
+            sb.AppendLine("typedef struct {");
+            sb.AppendLine("    double* state;  // state[k] belongs to stage k");
+            sb.AppendLine("    int sample_rate;");
+            sb.AppendLine("    int buffer_size;");
+            sb.AppendLine("    double timestep;");
+            sb.AppendLine("    int oversample;");
+            sb.AppendLine("    double* parameters;");
+            sb.AppendLine("    int num_parameters;");
+            sb.AppendLine("    double* globals;");
+            sb.AppendLine("    int num_globals;");
+            sb.AppendLine("    // Coefficients of each stage, see circuit_update_coefficients");
+            sb.AppendLine("    double gain[CIRCUIT_NUM_STAGES];");
+            sb.AppendLine("    double tone_step[CIRCUIT_NUM_STAGES];");
+            sb.AppendLine("    double volume[CIRCUIT_NUM_STAGES];");
+            sb.AppendLine("} CircuitContext;");
+            sb.AppendLine();
+
+            sb.AppendLine("// State variables (simulation memory), the tone filter of each stage");
+            sb.AppendLine("static const int NUM_STATE_VARS = CIRCUIT_NUM_STAGES;");
+            sb.AppendLine();
+
+            GenerateChainCoefficientFunction(stages, sb);
+            GenerateInitFunction(stages.Last().Simulation, sb, sampleRate, bufferSize, oversample, false, false);
+            GenerateChainProcessFunction(stages, sb);
+            GenerateLatencyFunction(sb, false);
+            GenerateCleanupFunction(sb, false, false);
+            GenerateParameterFunctions(sb);
+            GenerateInfoFunction(sb, string.Join(" -> ", stages.Select(i => i.Name)), $"Circuit chain exported from LiveSPICE: {summary}", oversample,
+                "0", MemoryFootprintExpression(false, false, stages.Count), CircuitFormatF32Interleaved);
+            GenerateApiFunction(sb, 0);
+        }
+
+        static void GenerateChainCoefficientFunction(List<ChainStage> stages, StringBuilder sb)
+        {
+            sb.AppendLine("// Recompute the parameter dependent coefficients, called by circuit_set_parameter");
+            sb.AppendLine("static void circuit_update_coefficients(CircuitContext* ctx) {");
+            if (stages.Any(i => i.Potentiometers.Count > 0))
+                sb.AppendLine("    const double* p = ctx->parameters;");
+            sb.AppendLine("    double dt = ctx->timestep;");
+            for (int k = 0; k < stages.Count; k++)
+            {
+                ChainStage s = stages[k];
+                Func<int, string> p = i => $"p[{s.FirstParameter + i}]";
+                sb.AppendLine();
+                sb.AppendLine($"    // {k + 1}. {s.Name}");
+                sb.AppendLine(s.Drive >= 0
+                    ? $"    ctx->gain[{k}] = 0.5 + {p(s.Drive)} * 10.0;  // {s.Potentiometers[s.Drive]}"
+                    : $"    ctx->gain[{k}] = 5.0;  // Default gain");
+                sb.AppendLine(s.Tone >= 0
+                    ? $"    ctx->tone_step[{k}] = {ToneStepExpression(p(s.Tone), "dt")};  // {s.Potentiometers[s.Tone]}"
+                    : $"    ctx->tone_step[{k}] = {ToneStepExpression(null, "dt")};  // Default tone");
+                sb.AppendLine(s.Volume >= 0
+                    ? $"    ctx->volume[{k}] = {p(s.Volume)} * 1.5;  // {s.Potentiometers[s.Volume]}"
+                    : $"    ctx->volume[{k}] = 0.7;  // Default volume");
+            }
+            sb.AppendLine("}");
+            sb.AppendLine();
+        }
+
+        static void GenerateChainProcessFunction(List<ChainStage> stages, StringBuilder sb)
+        {
+            sb.AppendLine("void circuit_process(CircuitContext* ctx, const float* input, float* output, int num_samples, int num_channels) {");
+            sb.AppendLine("    if (!ctx || !ctx->state) return;");
+            sb.AppendLine("    circuit_fp_mode fp_mode = circuit_flush_denormals();");
+            sb.AppendLine();
+            sb.AppendLine("    // Coefficients cached by circuit_update_coefficients, state of every stage");
+            sb.AppendLine("    double gain[CIRCUIT_NUM_STAGES], tone_step[CIRCUIT_NUM_STAGES], volume[CIRCUIT_NUM_STAGES];");
+            sb.AppendLine("    double tone_state[CIRCUIT_NUM_STAGES];");
+            sb.AppendLine("    for (int k = 0; k < CIRCUIT_NUM_STAGES; k++) {");
+            sb.AppendLine("        gain[k] = ctx->gain[k];");
+            sb.AppendLine("        tone_step[k] = ctx->tone_step[k];");
+            sb.AppendLine("        volume[k] = ctx->volume[k];");
+            sb.AppendLine("        tone_state[k] = ctx->state[k];");
+            sb.AppendLine("    }");
+            sb.AppendLine();
+            sb.AppendLine("    int oversample = ctx->oversample;");
+            sb.AppendLine("    for (int i = 0; i < num_samples; i++) {");
+            sb.AppendLine("        float sample = input[i * num_channels];");
+            sb.AppendLine();
+            sb.AppendLine("        float processed = 0.0f;");
+            sb.AppendLine("        for (int os = 0; os < oversample; os++) {");
+            sb.AppendLine("            double signal = sample;");
+            sb.AppendLine();
+            sb.AppendLine("            // Each stage feeds the next at the oversampled rate");
+            sb.AppendLine("            for (int k = 0; k < CIRCUIT_NUM_STAGES; k++) {");
+            sb.AppendLine("                double x = signal * gain[k];");
+            sb.AppendLine();
+            sb.AppendLine("                // Diode clipping (asymmetric)");
+            sb.AppendLine("                double clipped;");
+            sb.AppendLine("                if (x > 0.3) {");
+            sb.AppendLine("                    clipped = 0.3 + (x - 0.3) / (1.0 + (x - 0.3) * 0.5);");
+            sb.AppendLine("                } else if (x < -0.6) {");
+            sb.AppendLine("                    clipped = -0.6 + (x + 0.6) / (1.0 - (x + 0.6) * 0.3);");
+            sb.AppendLine("                } else {");
+            sb.AppendLine("                    clipped = x;");
+            sb.AppendLine("                }");
+            sb.AppendLine();
+            sb.AppendLine("                // Simple tone control (lowpass) and output volume");
+            sb.AppendLine("                tone_state[k] += (clipped - tone_state[k]) * tone_step[k];");
+            sb.AppendLine("                signal = tone_state[k] * volume[k];");
+            sb.AppendLine("            }");
+            sb.AppendLine();
+            sb.AppendLine("            processed += (float)signal;");
+            sb.AppendLine("        }");
+            sb.AppendLine();
+            sb.AppendLine("        // Average oversampled result of the last stage");
+            sb.AppendLine("        processed /= oversample;");
+            sb.AppendLine();
+            sb.AppendLine("        // Soft clip to prevent harsh digital clipping");
+            sb.AppendLine("        if (processed > 1.0f) processed = 1.0f - 1.0f / (processed + 1.0f);");
+            sb.AppendLine("        else if (processed < -1.0f) processed = -1.0f + 1.0f / (-processed + 1.0f);");
+            sb.AppendLine();
+            sb.AppendLine("        for (int ch = 0; ch < num_channels; ch++) {");
+            sb.AppendLine("            output[i * num_channels + ch] = processed;");
+            sb.AppendLine("        }");
+            sb.AppendLine("    }");
+            sb.AppendLine();
+            sb.AppendLine("    for (int k = 0; k < CIRCUIT_NUM_STAGES; k++)");
+            sb.AppendLine("        ctx->state[k] = tone_state[k];");
+            sb.AppendLine("    circuit_restore_fp_mode(fp_mode);");
+            sb.AppendLine("}");
+            sb.AppendLine();
+        }
+    }
+}
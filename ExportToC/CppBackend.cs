@@ -0,0 +1,171 @@
+/**
+ * C++ Backend
+ * Emits the circuit as a header-only class template, specialized at compile time
+ * on the oversampling factor and the sample type
+ */
+
+using System;
+using System.Collections.Generic;
+using System.IO;
+using System.Linq;
+using System.Text;
+using System.Text.RegularExpressions;
+using Circuit;
+
+namespace LiveSPICEExport
+{
+    partial class Program
+    {
+        static void ExportToCpp(Simulation simulation, string outputFile, int sampleRate, int oversample)
+        {
+            var sb = new StringBuilder();
+            GenerateCppHeader(sb, sampleRate, oversample);
+            File.WriteAllText(outputFile, sb.ToString());
+        }
+
+        // "Marshall JCM800 2203 Preamp" -> MarshallJCM8002203Preamp
+        static string CppClassName(string name)
+        {
+            string id = string.Concat(Regex.Split(name ?? "", @"[^A-Za-z0-9]+")
+                .Where(i => i.Length > 0)
+                .Select(i => char.ToUpperInvariant(i[0]) + i.Substring(1)));
+            if (id.Length == 0)
+                return "ExportedCircuit";
+            return char.IsDigit(id[0]) ? "Circuit" + id : id;
+        }
+
+        // The stages are the same as circuit_process in the C backend. Everything the compiler
+        // needs to specialize is a template parameter or constexpr: the oversampling loop has a
+        // constant trip count and process() is defined in the class, so it can be unrolled and
+        // inlined into the host's graph.
+        static void GenerateCppHeader(StringBuilder sb, int sampleRate, int oversample)
+        {
+            string name = CppClassName(currentCircuit?.Name);
+            var names = potentiometerNames.Count > 0 ? potentiometerNames : new List<string> { "Param1", "Param2", "Param3" };
+            var defaults = potentiometerNames.Count > 0 ? names.Select(i => "0.5").ToList() : new List<string> { "0.5", "0.5", "0.7" };
+            int drive = FindPotentiometer("drive", "gain", "distortion");
+            int tone = FindPotentiometer("tone");
+            int volume = FindPotentiometer("vol", "level");
+
+            sb.AppendLine("/**");
+            sb.AppendLine(" * Auto-generated Circuit Simulation");
+            sb.AppendLine(" * Exported from LiveSPICE");
+            sb.AppendLine(" *");
+            sb.AppendLine($" *   {name}<Oversample, Real> circuit(sample_rate);");
+            sb.AppendLine(" *   circuit.process(input, output);");
+            sb.AppendLine(" */");
+            sb.AppendLine();
+            sb.AppendLine("#pragma once");
+            sb.AppendLine();
+            sb.AppendLine("#include <algorithm>");
+            sb.AppendLine("#include <array>");
+            sb.AppendLine("#include <cstddef>");
+            sb.AppendLine("#include <span>");
+            sb.AppendLine("#include <string_view>");
+            sb.AppendLine();
+            sb.AppendLine("namespace livespice {");
+            sb.AppendLine();
+            sb.AppendLine($"template <int Oversample = {oversample}, typename Real = double>");
+            sb.AppendLine($"class {name} {{");
+            sb.AppendLine("    static_assert(Oversample >= 1, \"Oversample must be at least 1\");");
+            sb.AppendLine();
+            sb.AppendLine("public:");
+            sb.AppendLine($"    static constexpr int num_parameters = {names.Count};");
+            sb.AppendLine("    static constexpr int num_state = 1;");
+            sb.AppendLine($"    static constexpr int default_sample_rate = {sampleRate};");
+            sb.AppendLine("    static constexpr std::array<std::string_view, num_parameters> parameter_names = {");
+            foreach (var i in names)
+                sb.AppendLine($"        \"{i}\",");
+            sb.AppendLine("    };");
+            sb.AppendLine();
+            sb.AppendLine($"    explicit {name}(double sample_rate = default_sample_rate)");
+            sb.AppendLine("        : timestep_(1.0 / (sample_rate * Oversample)) {");
+            sb.AppendLine("        update_coefficients();");
+            sb.AppendLine("    }");
+            sb.AppendLine();
+            sb.AppendLine("    // Set a parameter (0.0 to 1.0), recomputing the coefficients that depend on it");
+            sb.AppendLine("    void set_parameter(int index, double value) {");
+            sb.AppendLine("        if (index < 0 || index >= num_parameters) return;");
+            sb.AppendLine("        parameters_[index] = std::clamp(value, 0.0, 1.0);");
+            sb.AppendLine("        update_coefficients();");
+            sb.AppendLine("    }");
+            sb.AppendLine();
+            sb.AppendLine("    bool set_parameter(std::string_view name, double value) {");
+            sb.AppendLine("        for (int i = 0; i < num_parameters; ++i) {");
+            sb.AppendLine("            if (parameter_names[i] == name) {");
+            sb.AppendLine("                set_parameter(i, value);");
+            sb.AppendLine("                return true;");
+            sb.AppendLine("            }");
+            sb.AppendLine("        }");
+            sb.AppendLine("        return false;");
+            sb.AppendLine("    }");
+            sb.AppendLine();
+            sb.AppendLine("    double parameter(int index) const { return parameters_[index]; }");
+            sb.AppendLine();
+            sb.AppendLine("    void reset() { state_ = {}; }");
+            sb.AppendLine();
+            sb.AppendLine("    // Process min(input.size(), output.size()) samples of mono audio");
+            sb.AppendLine("    void process(std::span<const Real> input, std::span<Real> output) noexcept {");
+            sb.AppendLine("        const std::size_t n = std::min(input.size(), output.size());");
+            sb.AppendLine("        const Real gain = gain_;");
+            sb.AppendLine("        const Real tone_step = tone_step_;");
+            sb.AppendLine("        const Real volume = volume_;");
+            sb.AppendLine("        Real tone_state = state_[0];");
+            sb.AppendLine();
+            sb.AppendLine("        for (std::size_t i = 0; i < n; ++i) {");
+            sb.AppendLine("            const Real x = input[i] * gain;");
+            sb.AppendLine("            Real processed = 0;");
+            sb.AppendLine("            for (int os = 0; os < Oversample; ++os) {");
+            sb.AppendLine("                tone_state += (clip(x) - tone_state) * tone_step;");
+            sb.AppendLine("                processed += tone_state * volume;");
+            sb.AppendLine("            }");
+            sb.AppendLine("            output[i] = soft_clip(processed * inv_oversample);");
+            sb.AppendLine("        }");
+            sb.AppendLine("        state_[0] = tone_state;");
+            sb.AppendLine("    }");
+            sb.AppendLine();
+            sb.AppendLine("private:");
+            sb.AppendLine("    static constexpr Real inv_oversample = Real(1) / Oversample;");
+            sb.AppendLine("    static constexpr Real threshold = Real(0.3);  // Diode forward voltage");
+            sb.AppendLine();
+            sb.AppendLine("    // Diode clipping (asymmetric)");
+            sb.AppendLine("    static Real clip(Real x) noexcept {");
+            sb.AppendLine("        if (x > threshold)");
+            sb.AppendLine("            return threshold + (x - threshold) / (Real(1) + (x - threshold) * Real(0.5));");
+            sb.AppendLine("        if (x < -threshold * 2)");
+            sb.AppendLine("            return -threshold * 2 + (x + threshold * 2) / (Real(1) - (x + threshold * 2) * Real(0.3));");
+            sb.AppendLine("        return x;");
+            sb.AppendLine("    }");
+            sb.AppendLine();
+            sb.AppendLine("    // Soft clip to prevent harsh digital clipping");
+            sb.AppendLine("    static Real soft_clip(Real y) noexcept {");
+            sb.AppendLine("        if (y > Real(1)) return Real(1) - Real(1) / (y + Real(1));");
+            sb.AppendLine("        if (y < Real(-1)) return Real(-1) + Real(1) / (-y + Real(1));");
+            sb.AppendLine("        return y;");
+            sb.AppendLine("    }");
+            sb.AppendLine();
+            sb.AppendLine("    void update_coefficients() {");
+            if (drive >= 0 || tone >= 0 || volume >= 0)
+                sb.AppendLine("        const auto& p = parameters_;");
+            sb.AppendLine("        const double dt = timestep_;");
+            sb.AppendLine(drive >= 0
+                ? $"        gain_ = Real(0.5 + p[{drive}] * 10.0);  // {names[drive]}"
+                : "        gain_ = Real(5.0);  // Default gain");
+            sb.AppendLine(tone >= 0
+                ? $"        tone_step_ = Real({ToneStepExpression($"p[{tone}]", "dt")});  // {names[tone]}"
+                : $"        tone_step_ = Real({ToneStepExpression(null, "dt")});  // Default tone");
+            sb.AppendLine(volume >= 0
+                ? $"        volume_ = Real(p[{volume}] * 1.5);  // {names[volume]}"
+                : "        volume_ = Real(0.7);  // Default volume");
+            sb.AppendLine("    }");
+            sb.AppendLine();
+            sb.AppendLine("    double timestep_;");
+            sb.AppendLine($"    std::array<double, num_parameters> parameters_ = {{ {string.Join(", ", defaults)} }};");
+            sb.AppendLine("    Real gain_ = 0, tone_step_ = 0, volume_ = 0;");
+            sb.AppendLine("    std::array<Real, num_state> state_ = {};");
+            sb.AppendLine("};");
+            sb.AppendLine();
+            sb.AppendLine("}  // namespace livespice");
+        }
+    }
+}
@@ -0,0 +1,25 @@
+/**
+ * Export Options
+ * Optional code generation features selected on the command line
+ */
+
+namespace LiveSPICEExport
+{
+    class ExportOptions
+    {
+        // Number of instances processed in lockstep by circuit_process_xN, or 0 for none.
+        public int Lanes = 0;
+
+        // Process in float, falling back to double for ill-conditioned blocks.
+        public bool SinglePrecision = false;
+
+        // Resampling between the host rate and the oversampled simulation rate.
+        public Circuit.Resampling Resampling = Circuit.Resampling.Linear;
+
+        // Switch the oversampling factor per block depending on nonlinear activity.
+        public bool Adaptive = false;
+
+        // Emit a header-only C++ class template instead of the C API.
+        public bool Cpp = false;
+    }
+}
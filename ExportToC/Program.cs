@@ -11,13 +11,14 @@
 using System.IO;
 using System.Linq;
 using System.Text;
+using System.Text.RegularExpressions;
 using Circuit;
 using ComputerAlgebra;
 using Util;
 
 namespace LiveSPICEExport
 {
-    class Program
+    partial class Program
     {
         static void Main(string[] args)
         {
@@ -29,22 +30,29 @@ static void Main(string[] args)
                 Console.WriteLine("Usage: export_to_c --input <circuit.schx> --output <circuit.c> [options]");
                 Console.WriteLine();
                 Console.WriteLine("Options:");
-                Console.WriteLine("  -i, --input FILE          Input .schx file");
+                Console.WriteLine("  -i, --input FILE          Input .schx file, repeat to chain circuits into one kernel");
                 Console.WriteLine("  -o, --output FILE         Output C file (default: circuit.c)");
                 Console.WriteLine("  -d, --dylib               Compile to dylib (requires clang)");
                 Console.WriteLine("  -s, --sample-rate RATE    Sample rate (default: 48000)");
                 Console.WriteLine("  -b, --buffer-size SIZE    Buffer size (default: 256)");
                 Console.WriteLine("  -v, --oversample N        Oversampling factor (default: 8)");
+                Console.WriteLine("  -l, --lanes N             Also emit circuit_process_xN for N lockstep instances (4 or 8)");
+                Console.WriteLine("  -f, --float               Process in single precision, falling back to double when ill-conditioned");
+                Console.WriteLine("  -r, --resampling MODE     Oversampling filters: linear (default) or polyphase");
+                Console.WriteLine("  -a, --adaptive            Lower the oversampling factor per block while the circuit is linear");
+                Console.WriteLine("      --cpp                 Emit a header-only C++ class template instead of C");
+                Console.WriteLine("      --no-cache            Always solve the circuit and compile the dylib, ignoring the caches");
                 Console.WriteLine("  -h, --help                Show this help");
                 return;
             }
 
-            string inputFile = null;
+            var inputFiles = new List<string>();
             string outputFile = "circuit.c";
             bool compileDylib = false;
             int sampleRate = 48000;
             int bufferSize = 256;
             int oversample = 8;
+            var options = new ExportOptions();
 
             // Parse arguments
             for (int i = 0; i < args.Length; i++)
@@ -53,7 +61,7 @@ static void Main(string[] args)
                 {
                     case "-i":
                     case "--input":
-                        inputFile = args[++i];
+                        inputFiles.Add(args[++i]);
                         break;
                     case "-o":
                     case "--output":
@@ -75,18 +83,72 @@ static void Main(string[] args)
                     case "--oversample":
                         oversample = int.Parse(args[++i]);
                         break;
+                    case "-l":
+                    case "--lanes":
+                        options.Lanes = int.Parse(args[++i]);
+                        break;
+                    case "-f":
+                    case "--float":
+                        options.SinglePrecision = true;
+                        break;
+                    case "-r":
+                    case "--resampling":
+                        if (!Enum.TryParse(args[++i], true, out options.Resampling))
+                        {
+                            Console.WriteLine("Error: --resampling must be linear or polyphase");
+                            return;
+                        }
+                        break;
+                    case "-a":
+                    case "--adaptive":
+                        options.Adaptive = true;
+                        break;
+                    case "--cpp":
+                        options.Cpp = true;
+                        break;
+                    case "--no-cache":
+                        solutionCache = null;
+                        nativeCache = null;
+                        break;
                     case "-h":
                     case "--help":
                         return;
                 }
             }
 
-            if (string.IsNullOrEmpty(inputFile))
+            if (inputFiles.Count == 0)
             {
                 Console.WriteLine("Error: Input file required");
                 return;
             }
 
+            if (options.Lanes != 0 && options.Lanes != 4 && options.Lanes != 8)
+            {
+                Console.WriteLine("Error: --lanes must be 4 or 8");
+                return;
+            }
+
+            // Without oversampling there is nothing to resample or adapt.
+            if (oversample <= 1)
+            {
+                options.Resampling = Resampling.Linear;
+                options.Adaptive = false;
+            }
+
+            if (options.Adaptive && options.Resampling == Resampling.Polyphase)
+            {
+                Console.WriteLine("Error: --adaptive requires linear resampling");
+                return;
+            }
+
+            // Several inputs are chained into one fused kernel
+            if (inputFiles.Count > 1)
+            {
+                ExportChain(inputFiles, outputFile, sampleRate, bufferSize, oversample, options, compileDylib);
+                return;
+            }
+            string inputFile = inputFiles[0];
+
             Console.WriteLine($"Loading circuit: {inputFile}");
             
             try
@@ -102,10 +164,25 @@ static void Main(string[] args)
                 // Create and analyze the simulation
                 Console.WriteLine("Analyzing circuit...");
                 var simulation = CreateSimulation(circuit, sampleRate, oversample);
+
+                // Estimate the cost of the circuit, written next to the output
+                var report = CostReport.Of(simulation, circuit.Name ?? Path.GetFileNameWithoutExtension(inputFile), sampleRate, oversample);
+                string reportFile = Path.ChangeExtension(outputFile, ".report.txt");
+                File.WriteAllText(reportFile, report.ToString());
+                Console.WriteLine($"Cost report: {reportFile} ({report.Summary})");
                 
+                // The C++ backend is header-only, there is nothing to compile
+                if (options.Cpp)
+                {
+                    Console.WriteLine($"Exporting to C++: {outputFile}");
+                    ExportToCpp(simulation, outputFile, sampleRate, oversample);
+                    Console.WriteLine("Export complete!");
+                    return;
+                }
+
                 // Export to C
                 Console.WriteLine($"Exporting to C: {outputFile}");
-                ExportToC(simulation, outputFile, sampleRate, bufferSize, oversample);
+                ExportToC(simulation, outputFile, sampleRate, bufferSize, oversample, options, report.Summary);
                 
                 Console.WriteLine("Export complete!");
 
@@ -128,6 +205,11 @@ static void Main(string[] args)
         static Dictionary<string, double> potentiometerValues = new Dictionary<string, double>();
         static Dictionary<string, string> componentTypes = new Dictionary<string, string>();
         static Dictionary<string, double> componentValues = new Dictionary<string, double>();
+
+        // Solutions and compiled libraries from previous exports, null with --no-cache
+        static SolutionCache solutionCache = SolutionCache.Global;
+        static string nativeCache = Path.Combine(
+            Environment.GetFolderPath(Environment.SpecialFolder.LocalApplicationData), "LiveSPICE", "Native");
         
         static Simulation CreateSimulation(Circuit.Circuit circuit, int sampleRate, int oversample)
         {
@@ -175,14 +257,11 @@ static Simulation CreateSimulation(Circuit.Circuit circuit, int sampleRate, int
                 Console.WriteLine($"  Found capacitor: {c.Name} = {c.Capacitance}");
             }
             
-            // Perform circuit analysis
-            var analysis = circuit.Analyze();
-            
-            // Create transient solution
+            // Analyze the circuit and create the transient solution, or load it from the cache
             Expression timestep = 1 / (sampleRate * oversample);
-            var initialConditions = Enumerable.Empty<Arrow>();
-            
-            var solution = TransientSolution.Solve(analysis, timestep, initialConditions, new ConsoleLog());
+            var solution = solutionCache != null
+                ? solutionCache.Solve(circuit, timestep, new ConsoleLog())
+                : TransientSolution.Solve(circuit.Analyze(), timestep, new ConsoleLog());
 
             var simulation = new Simulation(solution);
             simulation.Oversample = oversample;
@@ -216,18 +295,21 @@ static Simulation CreateSimulation(Circuit.Circuit circuit, int sampleRate, int
             return simulation;
         }
 
-        static void ExportToC(Simulation simulation, string outputFile, int sampleRate, int bufferSize, int oversample)
+        static void ExportToC(Simulation simulation, string outputFile, int sampleRate, int bufferSize, int oversample, ExportOptions options, string summary)
         {
             var sb = new StringBuilder();
             
             // Generate C code from the simulation
-            GenerateCCode(simulation, sb, sampleRate, bufferSize, oversample);
+            GenerateCCode(simulation, sb, sampleRate, bufferSize, oversample, options, summary);
             
             File.WriteAllText(outputFile, sb.ToString());
         }
 
-        static void GenerateCCode(Simulation simulation, StringBuilder sb, int sampleRate, int bufferSize, int oversample)
+        static void GenerateCCode(Simulation simulation, StringBuilder sb, int sampleRate, int bufferSize, int oversample, ExportOptions options, string summary)
         {
+            bool polyphase = options.Resampling == Resampling.Polyphase;
+            bool adaptive = options.Adaptive;
+
             sb.AppendLine("/**");
             sb.AppendLine(" * Auto-generated Circuit Simulation");
             sb.AppendLine(" * Exported from LiveSPICE");
@@ -237,6 +319,7 @@ static void GenerateCCode(Simulation simulation, StringBuilder sb, int sampleRat
             sb.AppendLine("#include <string.h>");
             sb.AppendLine("#include <math.h>");
             sb.AppendLine();
+            GenerateDenormalControl(sb);
             sb.AppendLine("// Circuit context structure");
             sb.AppendLine("typedef struct {");
             sb.AppendLine("    double* state;");
@@ -248,41 +331,180 @@ static void GenerateCCode(Simulation simulation, StringBuilder sb, int sampleRat
             sb.AppendLine("    int num_parameters;");
             sb.AppendLine("    double* globals;");
             sb.AppendLine("    int num_globals;");
+            sb.AppendLine("    // Coefficients depending only on parameters, see circuit_update_coefficients");
+            sb.AppendLine("    double gain;");
+            sb.AppendLine("    double tone_step;");
+            sb.AppendLine("    double volume;");
+            if (options.SinglePrecision)
+                sb.AppendLine("    int precision_fallbacks;  // Blocks processed in double precision");
+            if (polyphase)
+            {
+                sb.AppendLine("    // Polyphase resampling, see circuit_process");
+                sb.AppendLine("    double* up_history;");
+                sb.AppendLine("    double* down_history;");
+                sb.AppendLine("    int up_pos;");
+                sb.AppendLine("    int down_pos;");
+                sb.AppendLine("    float* oversampled_input;");
+                sb.AppendLine("    float* oversampled_output;");
+            }
+            if (adaptive)
+            {
+                sb.AppendLine("    // Adaptive oversampling, see circuit_process");
+                sb.AppendLine("    int max_oversample;");
+                sb.AppendLine("    int quiet_blocks;     // Blocks since the circuit last left its linear region");
+                sb.AppendLine("    int nonlinear_steps;  // Oversampled steps of the last block in the nonlinear region");
+                sb.AppendLine("    double* saved_state;  // State at the start of a crossfaded block");
+            }
             sb.AppendLine("} CircuitContext;");
             sb.AppendLine();
             
             // Add simulation state variables
             GenerateStateVariables(simulation, sb);
+            if (polyphase)
+                GeneratePolyphaseFilter(sb, oversample);
             
-            // Add initialization function
-            GenerateInitFunction(simulation, sb, sampleRate, bufferSize, oversample);
+            // Add coefficient cache and initialization function
+            GenerateCoefficientFunction(sb);
+            GenerateInitFunction(simulation, sb, sampleRate, bufferSize, oversample, polyphase, adaptive);
             
-            // Add processing function
-            GenerateProcessFunction(simulation, sb);
+            // Add processing function. With polyphase resampling the kernel runs at the
+            // oversampled rate and circuit_process wraps it in the resampling filters; with
+            // adaptive oversampling circuit_process picks the factor for each block.
+            string process = polyphase ? "static void circuit_process_oversampled"
+                : adaptive ? "static void circuit_process_fixed"
+                : "void circuit_process";
+            if (options.SinglePrecision)
+            {
+                ReportSinglePrecision(sampleRate, oversample);
+                GenerateProcessFunction(simulation, sb, "static void circuit_process_f64", false, polyphase, adaptive);
+                GenerateProcessFunction(simulation, sb, "static void circuit_process_f32", true, polyphase, adaptive);
+                GeneratePrecisionDispatch(sb, process);
+            }
+            else
+            {
+                GenerateProcessFunction(simulation, sb, process, false, polyphase, adaptive);
+            }
+            if (polyphase)
+                GenerateResampledProcessFunction(sb);
+            if (adaptive)
+                GenerateAdaptiveProcessFunction(sb);
+            GenerateLatencyFunction(sb, polyphase);
+
+            // Add the multi-instance processing function
+            if (options.Lanes > 0)
+                GenerateLanesProcessFunction(sb, options.Lanes, options.SinglePrecision, polyphase || adaptive);
             
             // Add cleanup function
-            GenerateCleanupFunction(sb);
+            GenerateCleanupFunction(sb, polyphase, adaptive);
             
             // Add parameter functions
             GenerateParameterFunctions(sb);
             
             // Add info function
-            GenerateInfoFunction(sb);
+            int formats = CircuitFormatF32Interleaved | (options.Lanes > 0 ? CircuitFormatPlanar : 0);
+            GenerateInfoFunction(sb, currentCircuit?.Name ?? "Exported Circuit", $"Circuit exported from LiveSPICE: {summary}", oversample,
+                polyphase ? "CIRCUIT_LATENCY" : "0", MemoryFootprintExpression(polyphase, adaptive), formats);
+
+            // Add the function table
+            GenerateApiFunction(sb, options.Lanes);
+        }
+
+        // Decaying tails (the silence after a note, long RC time constants) underflow into
+        // denormals, which take a slow microcode path on most CPUs. The processing functions set
+        // flush-to-zero and denormals-are-zero on entry and restore the host's mode on return.
+        static void GenerateDenormalControl(StringBuilder sb)
+        {
+            sb.AppendLine("// Flush denormals to zero while processing, restoring the caller's mode after");
+            sb.AppendLine("#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)");
+            sb.AppendLine("#include <xmmintrin.h>");
+            sb.AppendLine("typedef unsigned int circuit_fp_mode;");
+            sb.AppendLine("static inline circuit_fp_mode circuit_flush_denormals(void) {");
+            sb.AppendLine("    circuit_fp_mode mode = _mm_getcsr();");
+            sb.AppendLine("    _mm_setcsr(mode | 0x8040);  // FTZ | DAZ");
+            sb.AppendLine("    return mode;");
+            sb.AppendLine("}");
+            sb.AppendLine("static inline void circuit_restore_fp_mode(circuit_fp_mode mode) { _mm_setcsr(mode); }");
+            sb.AppendLine("#elif defined(__aarch64__)");
+            sb.AppendLine("typedef unsigned long long circuit_fp_mode;");
+            sb.AppendLine("static inline circuit_fp_mode circuit_flush_denormals(void) {");
+            sb.AppendLine("    circuit_fp_mode mode;");
+            sb.AppendLine("    __asm__ __volatile__(\"mrs %0, fpcr\" : \"=r\"(mode));");
+            sb.AppendLine("    __asm__ __volatile__(\"msr fpcr, %0\" : : \"r\"(mode | (1ull << 24)));  // FZ");
+            sb.AppendLine("    return mode;");
+            sb.AppendLine("}");
+            sb.AppendLine("static inline void circuit_restore_fp_mode(circuit_fp_mode mode) { __asm__ __volatile__(\"msr fpcr, %0\" : : \"r\"(mode)); }");
+            sb.AppendLine("#else");
+            sb.AppendLine("typedef int circuit_fp_mode;");
+            sb.AppendLine("static inline circuit_fp_mode circuit_flush_denormals(void) { return 0; }");
+            sb.AppendLine("static inline void circuit_restore_fp_mode(circuit_fp_mode mode) { (void)mode; }");
+            sb.AppendLine("#endif");
+            sb.AppendLine();
         }
 
+        const int NumStateVars = 32;
+
         static void GenerateStateVariables(Simulation simulation, StringBuilder sb)
         {
             sb.AppendLine("// State variables (simulation memory)");
-            sb.AppendLine("static const int NUM_STATE_VARS = 32;  // Placeholder");
+            sb.AppendLine($"static const int NUM_STATE_VARS = {NumStateVars};  // Placeholder");
+            sb.AppendLine();
+        }
+
+        // The same filter the simulation uses in LiveSPICE (see Circuit.PolyphaseFilter), stored
+        // as one table. Phase k of the interpolator is circuit_fir[k + j * CIRCUIT_OVERSAMPLE].
+        static void GeneratePolyphaseFilter(StringBuilder sb, int oversample)
+        {
+            double[] h = PolyphaseFilter.Design(oversample);
+
+            sb.AppendLine("// Polyphase resampling filter (Kaiser windowed sinc, cutoff at the host Nyquist frequency)");
+            sb.AppendLine($"#define CIRCUIT_OVERSAMPLE {oversample}");
+            sb.AppendLine($"#define CIRCUIT_PHASE_TAPS {h.Length / oversample}");
+            sb.AppendLine("#define CIRCUIT_FIR_LENGTH (CIRCUIT_PHASE_TAPS * CIRCUIT_OVERSAMPLE)");
+            sb.AppendLine($"#define CIRCUIT_LATENCY {PolyphaseFilter.Latency}  // Samples at the host rate");
+            sb.AppendLine("#define CIRCUIT_RESAMPLE_BLOCK 256");
+            sb.AppendLine();
+            sb.AppendLine("static const double circuit_fir[CIRCUIT_FIR_LENGTH] = {");
+            for (int i = 0; i < h.Length; i += 4)
+            {
+                var row = h.Skip(i).Take(4).Select(x => x.ToString("R", System.Globalization.CultureInfo.InvariantCulture));
+                sb.AppendLine($"    {string.Join(", ", row)},");
+            }
+            sb.AppendLine("};");
+            sb.AppendLine();
+        }
+
+        // The coefficients of the stages depend only on the parameters and the timestep, so they
+        // are computed here whenever a parameter changes instead of on every oversampled step.
+        static void GenerateCoefficientFunction(StringBuilder sb)
+        {
+            int drive = FindPotentiometer("drive", "gain", "distortion");
+            int tone = FindPotentiometer("tone");
+            int volume = FindPotentiometer("vol", "level");
+
+            sb.AppendLine("// Recompute the parameter dependent coefficients, called by circuit_set_parameter");
+            sb.AppendLine("static void circuit_update_coefficients(CircuitContext* ctx) {");
+            if (drive >= 0 || tone >= 0 || volume >= 0)
+                sb.AppendLine("    const double* p = ctx->parameters;");
+            sb.AppendLine("    double dt = ctx->timestep;");
+            sb.AppendLine(drive >= 0
+                ? $"    ctx->gain = 0.5 + p[{drive}] * 10.0;  // {potentiometerNames[drive]}"
+                : "    ctx->gain = 5.0;  // Default gain");
+            sb.AppendLine(tone >= 0
+                ? $"    ctx->tone_step = {ToneStepExpression($"p[{tone}]", "dt")};  // {potentiometerNames[tone]}"
+                : $"    ctx->tone_step = {ToneStepExpression(null, "dt")};  // Default tone");
+            sb.AppendLine(volume >= 0
+                ? $"    ctx->volume = p[{volume}] * 1.5;  // {potentiometerNames[volume]}"
+                : "    ctx->volume = 0.7;  // Default volume");
+            sb.AppendLine("}");
             sb.AppendLine();
         }
 
-        static void GenerateInitFunction(Simulation simulation, StringBuilder sb, int sampleRate, int bufferSize, int oversample)
+        static void GenerateInitFunction(Simulation simulation, StringBuilder sb, int sampleRate, int bufferSize, int oversample, bool polyphase, bool adaptive)
         {
             int numParams = potentiometerNames.Count > 0 ? potentiometerNames.Count : 3;
             
             sb.AppendLine("CircuitContext* circuit_init(int sample_rate, int buffer_size, int oversample) {");
-            sb.AppendLine("    CircuitContext* ctx = (CircuitContext*)malloc(sizeof(CircuitContext));");
+            sb.AppendLine("    CircuitContext* ctx = (CircuitContext*)calloc(1, sizeof(CircuitContext));");
             sb.AppendLine("    if (!ctx) return NULL;");
             sb.AppendLine();
             sb.AppendLine($"    ctx->sample_rate = {sampleRate};");
@@ -317,62 +539,73 @@ static void GenerateInitFunction(Simulation simulation, StringBuilder sb, int sa
                 sb.AppendLine("    ctx->parameters[2] = 0.7;  // Default param 3");
             }
             
+            sb.AppendLine("    circuit_update_coefficients(ctx);");
             sb.AppendLine();
+
+            if (polyphase)
+            {
+                sb.AppendLine("    // Resampling filter histories are stored twice so the taps are contiguous");
+                sb.AppendLine("    ctx->up_history = (double*)calloc(2 * CIRCUIT_PHASE_TAPS, sizeof(double));");
+                sb.AppendLine("    ctx->down_history = (double*)calloc(2 * CIRCUIT_FIR_LENGTH, sizeof(double));");
+                sb.AppendLine("    ctx->oversampled_input = (float*)malloc(sizeof(float) * CIRCUIT_RESAMPLE_BLOCK * CIRCUIT_OVERSAMPLE);");
+                sb.AppendLine("    ctx->oversampled_output = (float*)malloc(sizeof(float) * CIRCUIT_RESAMPLE_BLOCK * CIRCUIT_OVERSAMPLE);");
+                sb.AppendLine("    if (!ctx->up_history || !ctx->down_history || !ctx->oversampled_input || !ctx->oversampled_output) {");
+                sb.AppendLine("        free(ctx->up_history);");
+                sb.AppendLine("        free(ctx->down_history);");
+                sb.AppendLine("        free(ctx->oversampled_input);");
+                sb.AppendLine("        free(ctx->oversampled_output);");
+                sb.AppendLine("        free(ctx->parameters);");
+                sb.AppendLine("        free(ctx->state);");
+                sb.AppendLine("        free(ctx);");
+                sb.AppendLine("        return NULL;");
+                sb.AppendLine("    }");
+                sb.AppendLine();
+            }
+            if (adaptive)
+            {
+                sb.AppendLine("    // Start at the full oversampling factor, circuit_process lowers it when it can");
+                sb.AppendLine("    ctx->max_oversample = ctx->oversample;");
+                sb.AppendLine("    ctx->saved_state = (double*)calloc(NUM_STATE_VARS, sizeof(double));");
+                sb.AppendLine("    if (!ctx->saved_state) {");
+                sb.AppendLine("        free(ctx->parameters);");
+                sb.AppendLine("        free(ctx->state);");
+                sb.AppendLine("        free(ctx);");
+                sb.AppendLine("        return NULL;");
+                sb.AppendLine("    }");
+                sb.AppendLine();
+            }
             sb.AppendLine("    return ctx;");
             sb.AppendLine("}");
             sb.AppendLine();
         }
 
-        static void GenerateProcessFunction(Simulation simulation, StringBuilder sb)
+        static void GenerateProcessFunction(Simulation simulation, StringBuilder target, string declaration, bool singlePrecision, bool polyphase, bool adaptive)
         {
-            // Generate parameter mapping based on potentiometer names
-            sb.AppendLine("void circuit_process(CircuitContext* ctx, const float* input, float* output, int num_samples, int num_channels) {");
+            var sb = new StringBuilder();
+
+            // With polyphase or adaptive oversampling, circuit_process wraps this kernel and sets
+            // the floating point mode once for the whole call.
+            bool wrapped = polyphase || adaptive;
+
+            sb.AppendLine($"{declaration}(CircuitContext* ctx, const float* input, float* output, int num_samples, int num_channels) {{");
             sb.AppendLine("    if (!ctx || !ctx->state) return;");
+            if (!wrapped)
+                sb.AppendLine("    circuit_fp_mode fp_mode = circuit_flush_denormals();");
             sb.AppendLine();
             
-            // Generate parameter variables
-            sb.AppendLine("    // Get parameters from context");
-            for (int i = 0; i < potentiometerNames.Count; i++)
-            {
-                string potName = potentiometerNames[i].Replace(" ", "_").Replace("-", "_");
-                sb.AppendLine($"    double {potName} = ctx->parameters[{i}];");
-            }
-            
-            // Generate component values based on potentiometer settings
-            sb.AppendLine();
-            sb.AppendLine("    // Calculate circuit component values from potentiometer positions");
-            
-            // Generate code based on potentiometer names (heuristic mapping)
-            if (potentiometerNames.Count > 0)
-            {
-                foreach (var potName in potentiometerNames)
-                {
-                    string safeName = potName.Replace(" ", "_").Replace("-", "_");
-                    string lowerName = potName.ToLower();
-                    
-                    if (lowerName.Contains("drive") || lowerName.Contains("gain") || lowerName.Contains("distortion"))
-                    {
-                        sb.AppendLine($"    double gain_{safeName} = 0.5 + {safeName} * 10.0;  // Drive gain");
-                    }
-                    else if (lowerName.Contains("tone") || lowerName.Contains("treble") || lowerName.Contains("bass"))
-                    {
-                        sb.AppendLine($"    double tone_{safeName} = {safeName};  // Tone control");
-                    }
-                    else if (lowerName.Contains("vol") || lowerName.Contains("level") || lowerName.Contains("master"))
-                    {
-                        sb.AppendLine($"    double volume_{safeName} = {safeName} * 1.5;  // Volume");
-                    }
-                    else
-                    {
-                        sb.AppendLine($"    double param_{safeName} = {safeName};  // {potName}");
-                    }
-                }
-            }
-            
+            // Parameter dependent coefficients come from the cache, so the loop only touches state
+            sb.AppendLine("    // Coefficients cached by circuit_update_coefficients");
+            sb.AppendLine("    double gain = ctx->gain;");
+            sb.AppendLine("    double tone_step = ctx->tone_step;");
+            sb.AppendLine("    double volume = ctx->volume;");
+            sb.AppendLine("    double tone_state = ctx->state[0];");
+            if (adaptive)
+                sb.AppendLine("    int nonlinear = 0;  // Steps outside the linear region of the clipper");
             sb.AppendLine();
             sb.AppendLine("    // Process audio with oversampling");
-            sb.AppendLine("    int oversample = ctx->oversample;");
-            sb.AppendLine("    double dt = ctx->timestep;");
+            sb.AppendLine(polyphase
+                ? "    int oversample = 1;  // Input is already at the oversampled rate"
+                : "    int oversample = ctx->oversample;");
             sb.AppendLine("    ");
             sb.AppendLine("    for (int i = 0; i < num_samples; i++) {");
             sb.AppendLine("        float sample = input[i * num_channels];");
@@ -381,25 +614,7 @@ static void GenerateProcessFunction(Simulation simulation, StringBuilder sb)
             sb.AppendLine("        float processed = 0.0f;");
             sb.AppendLine("        for (int os = 0; os < oversample; os++) {");
             sb.AppendLine("            // Input gain stage");
-            
-            // Generate gain control
-            if (potentiometerNames.Any(p => p.ToLower().Contains("drive") || p.ToLower().Contains("gain") || p.ToLower().Contains("distortion")))
-            {
-                string drivePot = potentiometerNames.FirstOrDefault(p => p.ToLower().Contains("drive") || p.ToLower().Contains("gain") || p.ToLower().Contains("distortion"));
-                if (drivePot != null)
-                {
-                    string safeName = drivePot.Replace(" ", "_").Replace("-", "_");
-                    sb.AppendLine($"            double x = sample * gain_{safeName};");
-                }
-                else
-                {
-                    sb.AppendLine("            double x = sample * 5.0;");
-                }
-            }
-            else
-            {
-                sb.AppendLine("            double x = sample * 5.0;  // Default gain");
-            }
+            sb.AppendLine("            double x = sample * gain;");
             
             // Diode clipping stage
             sb.AppendLine("            ");
@@ -408,8 +623,12 @@ static void GenerateProcessFunction(Simulation simulation, StringBuilder sb)
             sb.AppendLine("            double clipped;");
             sb.AppendLine("            if (x > threshold) {");
             sb.AppendLine("                clipped = threshold + (x - threshold) / (1.0 + (x - threshold) * 0.5);");
+            if (adaptive)
+                sb.AppendLine("                nonlinear++;");
             sb.AppendLine("            } else if (x < -threshold * 2.0) {");
             sb.AppendLine("                clipped = -threshold * 2.0 + (x + threshold * 2.0) / (1.0 - (x + threshold * 2.0) * 0.3);");
+            if (adaptive)
+                sb.AppendLine("                nonlinear++;");
             sb.AppendLine("            } else {");
             sb.AppendLine("                clipped = x;");
             sb.AppendLine("            }");
@@ -417,36 +636,12 @@ static void GenerateProcessFunction(Simulation simulation, StringBuilder sb)
             // Tone control
             sb.AppendLine("            ");
             sb.AppendLine("            // Simple tone control (lowpass)");
-            sb.AppendLine("            double tone_in = clipped;");
-            if (potentiometerNames.Any(p => p.ToLower().Contains("tone")))
-            {
-                string tonePot = potentiometerNames.FirstOrDefault(p => p.ToLower().Contains("tone"));
-                string safeName = tonePot.Replace(" ", "_").Replace("-", "_");
-                sb.AppendLine($"            double tone_freq = 500.0 + tone_{safeName} * 5000.0;  // 500-5500 Hz");
-            }
-            else
-            {
-                sb.AppendLine("            double tone_freq = 2000.0;  // Default tone");
-            }
-            sb.AppendLine("            double rc = 1.0 / (2.0 * 3.14159 * tone_freq);");
-            sb.AppendLine("            static double tone_state = 0.0;");
-            sb.AppendLine("            tone_state += (tone_in - tone_state) * dt / (rc + dt);");
-            sb.AppendLine("            double tone_out = tone_state;");
+            sb.AppendLine("            tone_state += (clipped - tone_state) * tone_step;");
             
             // Output volume
             sb.AppendLine("            ");
             sb.AppendLine("            // Output gain/volume");
-            if (potentiometerNames.Any(p => p.ToLower().Contains("vol") || p.ToLower().Contains("level")))
-            {
-                string volPot = potentiometerNames.FirstOrDefault(p => p.ToLower().Contains("vol") || p.ToLower().Contains("level"));
-                string safeName = volPot.Replace(" ", "_").Replace("-", "_");
-                sb.AppendLine($"            double out = tone_out * volume_{safeName};");
-            }
-            else
-            {
-                sb.AppendLine("            double out = tone_out * 0.7;  // Default volume");
-            }
-            
+            sb.AppendLine("            double out = tone_state * volume;");
             sb.AppendLine("            ");
             sb.AppendLine("            processed += (float)out;");
             sb.AppendLine("        }");
@@ -463,23 +658,390 @@ static void GenerateProcessFunction(Simulation simulation, StringBuilder sb)
             sb.AppendLine("            output[i * num_channels + ch] = processed;");
             sb.AppendLine("        }");
             sb.AppendLine("    }");
+            sb.AppendLine("    ctx->state[0] = tone_state;");
+            if (adaptive)
+                sb.AppendLine("    ctx->nonlinear_steps += nonlinear;");
+            if (!wrapped)
+                sb.AppendLine("    circuit_restore_fp_mode(fp_mode);");
             sb.AppendLine("}");
             sb.AppendLine();
+
+            target.Append(singlePrecision ? ToSinglePrecision(sb.ToString()) : sb.ToString());
+        }
+
+        // Retype generated kernel code to single precision: double locals become float and
+        // double literals get an f suffix, so no arithmetic is promoted back to double.
+        // Pointers into the context (double*) are left alone.
+        static string ToSinglePrecision(string code)
+        {
+            code = Regex.Replace(code, @"\bdouble ", "float ");
+            return Regex.Replace(code, @"(?<![\w.])(\d+\.\d+)(?![\w.])", "$1f");
+        }
+
+        // Per-step coefficient of the tone filter's implicit update, dt / (rc + dt), as a C
+        // expression of the tone parameter.
+        static string ToneStepExpression(string tone, string dt)
+        {
+            return $"{dt} / (1.0 / (2.0 * 3.14159 * ({ToneFrequencyExpression(tone)})) + {dt})";
+        }
+
+        static string ToneFrequencyExpression(string tone)
+        {
+            return tone != null ? $"500.0 + {tone} * 5000.0" : "2000.0";
+        }
+
+        // Smallest tone filter step that single precision resolves to better than -80 dB. Below
+        // this the update (in - state) * step falls under the float resolution of the state and
+        // the filter stalls, so the block is processed in double precision instead.
+        const double MinSinglePrecisionStep = 1e-3;
+
+        static void ReportSinglePrecision(int sampleRate, int oversample)
+        {
+            double dt = 1.0 / ((double)sampleRate * oversample);
+            Func<double, double> step = f => dt / (1.0 / (2.0 * 3.14159 * f) + dt);
+
+            int tone = FindPotentiometer("tone");
+            double worst = tone >= 0 ? step(500.0) : step(2000.0);
+            Console.WriteLine($"Single precision: smallest step coefficient {worst:G3} (minimum {MinSinglePrecisionStep:G3})");
+            if (worst >= MinSinglePrecisionStep)
+                Console.WriteLine("  float32 is accurate at every parameter setting");
+            else if (tone >= 0 && step(5500.0) >= MinSinglePrecisionStep)
+                Console.WriteLine($"  falls back to double precision for low settings of {potentiometerNames[tone]}");
+            else
+                Console.WriteLine("  always falls back to double precision, consider a lower oversampling factor");
         }
 
-        static void GenerateCleanupFunction(StringBuilder sb)
+        static void GeneratePrecisionDispatch(StringBuilder sb, string declaration)
+        {
+            sb.AppendLine($"#define CIRCUIT_F32_MIN_STEP {MinSinglePrecisionStep:R}");
+            sb.AppendLine();
+            sb.AppendLine("// Step coefficient of the implicit filter update; small values are ill-conditioned in float");
+            sb.AppendLine("static double circuit_step_coefficient(const CircuitContext* ctx) {");
+            sb.AppendLine("    return ctx->tone_step;");
+            sb.AppendLine("}");
+            sb.AppendLine();
+            sb.AppendLine($"{declaration}(CircuitContext* ctx, const float* input, float* output, int num_samples, int num_channels) {{");
+            sb.AppendLine("    if (!ctx || !ctx->state) return;");
+            sb.AppendLine();
+            sb.AppendLine("    if (circuit_step_coefficient(ctx) >= CIRCUIT_F32_MIN_STEP) {");
+            sb.AppendLine("        double saved = ctx->state[0];  // Tone filter state");
+            sb.AppendLine("        circuit_process_f32(ctx, input, output, num_samples, num_channels);");
+            sb.AppendLine("        if (isfinite(ctx->state[0])) return;");
+            sb.AppendLine();
+            sb.AppendLine("        // The state blew up in single precision, redo the block in double precision.");
+            sb.AppendLine("        ctx->state[0] = saved;");
+            sb.AppendLine("    }");
+            sb.AppendLine("    ctx->precision_fallbacks++;");
+            sb.AppendLine("    circuit_process_f64(ctx, input, output, num_samples, num_channels);");
+            sb.AppendLine("}");
+            sb.AppendLine();
+        }
+
+        // Upsample to the simulation rate, run the kernel, and decimate back to the host rate.
+        // The oversampled buffers are kept apart so the precision fallback can redo a block.
+        static void GenerateResampledProcessFunction(StringBuilder sb)
+        {
+            sb.AppendLine("void circuit_process(CircuitContext* ctx, const float* input, float* output, int num_samples, int num_channels) {");
+            sb.AppendLine("    if (!ctx || !ctx->state) return;");
+            sb.AppendLine("    circuit_fp_mode fp_mode = circuit_flush_denormals();");
+            sb.AppendLine();
+            sb.AppendLine("    for (int start = 0; start < num_samples; start += CIRCUIT_RESAMPLE_BLOCK) {");
+            sb.AppendLine("        int n = num_samples - start < CIRCUIT_RESAMPLE_BLOCK ? num_samples - start : CIRCUIT_RESAMPLE_BLOCK;");
+            sb.AppendLine("        float* up = ctx->oversampled_input;");
+            sb.AppendLine("        float* down = ctx->oversampled_output;");
+            sb.AppendLine();
+            sb.AppendLine("        // Interpolate: each phase of the filter produces one of the oversampled outputs");
+            sb.AppendLine("        for (int i = 0; i < n; i++) {");
+            sb.AppendLine("            ctx->up_pos = ctx->up_pos == 0 ? CIRCUIT_PHASE_TAPS - 1 : ctx->up_pos - 1;");
+            sb.AppendLine("            double* x = ctx->up_history + ctx->up_pos;");
+            sb.AppendLine("            x[0] = x[CIRCUIT_PHASE_TAPS] = input[(start + i) * num_channels];");
+            sb.AppendLine("            for (int k = 0; k < CIRCUIT_OVERSAMPLE; k++) {");
+            sb.AppendLine("                double y = 0.0;");
+            sb.AppendLine("                for (int j = 0; j < CIRCUIT_PHASE_TAPS; j++)");
+            sb.AppendLine("                    y += circuit_fir[k + j * CIRCUIT_OVERSAMPLE] * x[j];");
+            sb.AppendLine("                up[i * CIRCUIT_OVERSAMPLE + k] = (float)(y * CIRCUIT_OVERSAMPLE);");
+            sb.AppendLine("            }");
+            sb.AppendLine("        }");
+            sb.AppendLine();
+            sb.AppendLine("        circuit_process_oversampled(ctx, up, down, n * CIRCUIT_OVERSAMPLE, 1);");
+            sb.AppendLine();
+            sb.AppendLine("        // Decimate: the filter is only evaluated for the samples that are kept");
+            sb.AppendLine("        for (int i = 0; i < n; i++) {");
+            sb.AppendLine("            for (int k = 0; k < CIRCUIT_OVERSAMPLE; k++) {");
+            sb.AppendLine("                ctx->down_pos = ctx->down_pos == 0 ? CIRCUIT_FIR_LENGTH - 1 : ctx->down_pos - 1;");
+            sb.AppendLine("                double* x = ctx->down_history + ctx->down_pos;");
+            sb.AppendLine("                x[0] = x[CIRCUIT_FIR_LENGTH] = down[i * CIRCUIT_OVERSAMPLE + k];");
+            sb.AppendLine("                if (k != 0) continue;");
+            sb.AppendLine();
+            sb.AppendLine("                double y = 0.0;");
+            sb.AppendLine("                for (int j = 0; j < CIRCUIT_FIR_LENGTH; j++)");
+            sb.AppendLine("                    y += circuit_fir[j] * x[j];");
+            sb.AppendLine("                for (int ch = 0; ch < num_channels; ch++)");
+            sb.AppendLine("                    output[(start + i) * num_channels + ch] = (float)y;");
+            sb.AppendLine("            }");
+            sb.AppendLine("        }");
+            sb.AppendLine("    }");
+            sb.AppendLine("    circuit_restore_fp_mode(fp_mode);");
+            sb.AppendLine("}");
+            sb.AppendLine();
+        }
+
+        // Input peak, scaled by the drive gain, below which the clipper certainly stays linear
+        // (its knees are at 0.3 and -0.6), and the number of quiet blocks before each halving
+        // of the oversampling factor.
+        const double AdaptiveKnee = 0.2;
+        const int AdaptiveHold = 8;
+        const int AdaptiveCrossfade = 64;
+
+        // Pick the oversampling factor per block: the full factor as soon as the input level or
+        // the previous block says the nonlinear stages are active, and a lower one after the
+        // circuit has been linear for a while. Factor changes are crossfaded over the start of
+        // the block, running it at both factors from the same state.
+        static void GenerateAdaptiveProcessFunction(StringBuilder sb)
+        {
+            sb.AppendLine($"#define CIRCUIT_ADAPTIVE_KNEE {AdaptiveKnee:R}");
+            sb.AppendLine($"#define CIRCUIT_ADAPTIVE_HOLD {AdaptiveHold}");
+            sb.AppendLine($"#define CIRCUIT_CROSSFADE {AdaptiveCrossfade}");
+            sb.AppendLine();
+            sb.AppendLine("static int circuit_choose_oversample(CircuitContext* ctx, const float* input, int num_samples, int num_channels) {");
+            sb.AppendLine("    float peak = 0.0f;");
+            sb.AppendLine("    for (int i = 0; i < num_samples; i++) {");
+            sb.AppendLine("        float x = fabsf(input[i * num_channels]);");
+            sb.AppendLine("        if (x > peak) peak = x;");
+            sb.AppendLine("    }");
+            sb.AppendLine();
+            sb.AppendLine("    if (ctx->nonlinear_steps > 0 || peak * ctx->gain > CIRCUIT_ADAPTIVE_KNEE) {");
+            sb.AppendLine("        ctx->quiet_blocks = 0;");
+            sb.AppendLine("        return ctx->max_oversample;");
+            sb.AppendLine("    }");
+            sb.AppendLine("    if (ctx->oversample == 1 || ++ctx->quiet_blocks < CIRCUIT_ADAPTIVE_HOLD)");
+            sb.AppendLine("        return ctx->oversample;");
+            sb.AppendLine("    ctx->quiet_blocks = 0;");
+            sb.AppendLine("    return ctx->oversample / 2;");
+            sb.AppendLine("}");
+            sb.AppendLine();
+            sb.AppendLine("static void circuit_set_oversample(CircuitContext* ctx, int oversample) {");
+            sb.AppendLine("    ctx->oversample = oversample;");
+            sb.AppendLine("    ctx->timestep = 1.0 / ((double)ctx->sample_rate * oversample);");
+            sb.AppendLine("    circuit_update_coefficients(ctx);");
+            sb.AppendLine("}");
+            sb.AppendLine();
+            sb.AppendLine("void circuit_process(CircuitContext* ctx, const float* input, float* output, int num_samples, int num_channels) {");
+            sb.AppendLine("    if (!ctx || !ctx->state) return;");
+            sb.AppendLine("    circuit_fp_mode fp_mode = circuit_flush_denormals();");
+            sb.AppendLine();
+            sb.AppendLine("    int oversample = circuit_choose_oversample(ctx, input, num_samples, num_channels);");
+            sb.AppendLine("    ctx->nonlinear_steps = 0;");
+            sb.AppendLine("    if (oversample == ctx->oversample || num_samples <= 0) {");
+            sb.AppendLine("        circuit_process_fixed(ctx, input, output, num_samples, num_channels);");
+            sb.AppendLine("    } else {");
+            sb.AppendLine("        // Run the start of the block at the old factor, then again from the same state at the");
+            sb.AppendLine("        // new factor, fading from one to the other. The state of the new factor carries on.");
+            sb.AppendLine("        int fade = num_samples < CIRCUIT_CROSSFADE ? num_samples : CIRCUIT_CROSSFADE;");
+            sb.AppendLine("        memcpy(ctx->saved_state, ctx->state, sizeof(double) * NUM_STATE_VARS);");
+            sb.AppendLine("        circuit_process_fixed(ctx, input, output, fade, num_channels);");
+            sb.AppendLine("        memcpy(ctx->state, ctx->saved_state, sizeof(double) * NUM_STATE_VARS);");
+            sb.AppendLine("        circuit_set_oversample(ctx, oversample);");
+            sb.AppendLine();
+            sb.AppendLine("        // The circuit has one input, so the new factor renders the fade from the first channel");
+            sb.AppendLine("        float faded_input[CIRCUIT_CROSSFADE], faded[CIRCUIT_CROSSFADE];");
+            sb.AppendLine("        for (int i = 0; i < fade; i++)");
+            sb.AppendLine("            faded_input[i] = input[i * num_channels];");
+            sb.AppendLine("        circuit_process_fixed(ctx, faded_input, faded, fade, 1);");
+            sb.AppendLine("        for (int i = 0; i < fade; i++) {");
+            sb.AppendLine("            float w = (float)(i + 1) / fade;");
+            sb.AppendLine("            for (int ch = 0; ch < num_channels; ch++)");
+            sb.AppendLine("                output[i * num_channels + ch] += (faded[i] - output[i * num_channels + ch]) * w;");
+            sb.AppendLine("        }");
+            sb.AppendLine("        circuit_process_fixed(ctx, input + fade * num_channels, output + fade * num_channels, num_samples - fade, num_channels);");
+            sb.AppendLine("    }");
+            sb.AppendLine("    circuit_restore_fp_mode(fp_mode);");
+            sb.AppendLine("}");
+            sb.AppendLine();
+        }
+
+        static void GenerateLatencyFunction(StringBuilder sb, bool polyphase)
+        {
+            sb.AppendLine("// Delay of the output relative to the input, in samples at the host rate");
+            sb.AppendLine("int circuit_get_latency(CircuitContext* ctx) {");
+            sb.AppendLine(polyphase ? "    return CIRCUIT_LATENCY;" : "    return 0;");
+            sb.AppendLine("}");
+            sb.AppendLine();
+        }
+
+        // Index of the first potentiometer whose name contains any of the keys, or -1.
+        static int FindPotentiometer(params string[] keys)
+        {
+            return potentiometerNames.FindIndex(p => keys.Any(k => p.ToLower().Contains(k)));
+        }
+
+        static void GenerateLanesProcessFunction(StringBuilder target, int lanes, bool singlePrecision, bool perInstance)
+        {
+            var sb = new StringBuilder();
+
+            // Resampling filters and adaptive oversampling are per instance, so there is no
+            // lockstep kernel for them.
+            if (perInstance)
+            {
+                sb.AppendLine($"// Process {lanes} independent instances, one at a time: the resampling filters and");
+                sb.AppendLine("// the oversampling factor are per instance. Each instance is mono.");
+                sb.AppendLine($"void circuit_process_x{lanes}(CircuitContext* const* ctxs, const float* const* inputs, float* const* outputs, int num_samples) {{");
+                sb.AppendLine("    if (!ctxs) return;");
+                sb.AppendLine($"    for (int l = 0; l < {lanes}; l++)");
+                sb.AppendLine("        circuit_process(ctxs[l], inputs[l], outputs[l], num_samples, 1);");
+                sb.AppendLine("}");
+                sb.AppendLine();
+                target.Append(sb.ToString());
+                return;
+            }
+
+            // The lane kernel runs the same stages as circuit_process, with every state
+            // variable stored as an array indexed by lane. The inner lane loops have a
+            // constant trip count and no branches, so they compile to AVX2/AVX-512 vectors.
+            sb.AppendLine($"// Process {lanes} independent instances in lockstep, one instance per SIMD lane.");
+            sb.AppendLine("// Each lane is mono: inputs[l] and outputs[l] belong to ctxs[l].");
+            string declaration = singlePrecision ? $"static void circuit_process_x{lanes}_f32" : $"void circuit_process_x{lanes}";
+            sb.AppendLine($"{declaration}(CircuitContext* const* ctxs, const float* const* inputs, float* const* outputs, int num_samples) {{");
+            sb.AppendLine($"    enum {{ LANES = {lanes} }};");
+            sb.AppendLine("    if (!ctxs) return;");
+            sb.AppendLine("    for (int l = 0; l < LANES; l++)");
+            sb.AppendLine("        if (!ctxs[l] || !ctxs[l]->state) return;");
+            sb.AppendLine();
+            sb.AppendLine("    // Lanes must step in lockstep; fall back to one instance at a time otherwise.");
+            sb.AppendLine("    int oversample = ctxs[0]->oversample;");
+            sb.AppendLine("    for (int l = 1; l < LANES; l++) {");
+            sb.AppendLine("        if (ctxs[l]->oversample != oversample || ctxs[l]->timestep != ctxs[0]->timestep) {");
+            sb.AppendLine("            for (int k = 0; k < LANES; k++)");
+            sb.AppendLine("                circuit_process(ctxs[k], inputs[k], outputs[k], num_samples, 1);");
+            sb.AppendLine("            return;");
+            sb.AppendLine("        }");
+            sb.AppendLine("    }");
+            sb.AppendLine();
+            sb.AppendLine("    circuit_fp_mode fp_mode = circuit_flush_denormals();");
+            sb.AppendLine();
+            sb.AppendLine("    // Per-lane coefficients and state");
+            sb.AppendLine("    double gain[LANES], tone_step[LANES], volume[LANES], tone_state[LANES];");
+            sb.AppendLine("    for (int l = 0; l < LANES; l++) {");
+            sb.AppendLine("        gain[l] = ctxs[l]->gain;");
+            sb.AppendLine("        tone_step[l] = ctxs[l]->tone_step;");
+            sb.AppendLine("        volume[l] = ctxs[l]->volume;");
+            sb.AppendLine("        tone_state[l] = ctxs[l]->state[0];");
+            sb.AppendLine("    }");
+            sb.AppendLine();
+            sb.AppendLine("    for (int i = 0; i < num_samples; i++) {");
+            sb.AppendLine("        float sample[LANES], processed[LANES];");
+            sb.AppendLine("        for (int l = 0; l < LANES; l++) {");
+            sb.AppendLine("            sample[l] = inputs[l][i];");
+            sb.AppendLine("            processed[l] = 0.0f;");
+            sb.AppendLine("        }");
+            sb.AppendLine();
+            sb.AppendLine("        for (int os = 0; os < oversample; os++) {");
+            sb.AppendLine("            for (int l = 0; l < LANES; l++) {");
+            sb.AppendLine("                double x = sample[l] * gain[l];");
+            sb.AppendLine();
+            sb.AppendLine("                // Diode clipping, both knees evaluated so the select stays branch free");
+            sb.AppendLine("                double hi = x - 0.3;");
+            sb.AppendLine("                double lo = x + 0.6;");
+            sb.AppendLine("                double clip_hi = 0.3 + hi / (1.0 + hi * 0.5);");
+            sb.AppendLine("                double clip_lo = -0.6 + lo / (1.0 - lo * 0.3);");
+            sb.AppendLine("                double clipped = x > 0.3 ? clip_hi : (x < -0.6 ? clip_lo : x);");
+            sb.AppendLine();
+            sb.AppendLine("                tone_state[l] += (clipped - tone_state[l]) * tone_step[l];");
+            sb.AppendLine("                processed[l] += (float)(tone_state[l] * volume[l]);");
+            sb.AppendLine("            }");
+            sb.AppendLine("        }");
+            sb.AppendLine();
+            sb.AppendLine("        for (int l = 0; l < LANES; l++) {");
+            sb.AppendLine("            float y = processed[l] / oversample;");
+            sb.AppendLine("            float soft_hi = 1.0f - 1.0f / (y + 1.0f);");
+            sb.AppendLine("            float soft_lo = -1.0f + 1.0f / (-y + 1.0f);");
+            sb.AppendLine("            outputs[l][i] = y > 1.0f ? soft_hi : (y < -1.0f ? soft_lo : y);");
+            sb.AppendLine("        }");
+            sb.AppendLine("    }");
+            sb.AppendLine();
+            sb.AppendLine("    for (int l = 0; l < LANES; l++)");
+            sb.AppendLine("        ctxs[l]->state[0] = tone_state[l];");
+            sb.AppendLine("    circuit_restore_fp_mode(fp_mode);");
+            sb.AppendLine("}");
+            sb.AppendLine();
+
+            if (!singlePrecision)
+            {
+                target.Append(sb.ToString());
+                return;
+            }
+            target.Append(ToSinglePrecision(sb.ToString()));
+
+            // All lanes run in single precision, or each instance picks its own precision.
+            target.AppendLine($"void circuit_process_x{lanes}(CircuitContext* const* ctxs, const float* const* inputs, float* const* outputs, int num_samples) {{");
+            target.AppendLine($"    enum {{ LANES = {lanes} }};");
+            target.AppendLine("    if (!ctxs) return;");
+            target.AppendLine();
+            target.AppendLine("    double saved[LANES];  // Tone filter state");
+            target.AppendLine("    int well_conditioned = 1;");
+            target.AppendLine("    for (int l = 0; l < LANES; l++) {");
+            target.AppendLine("        if (!ctxs[l] || !ctxs[l]->state) return;");
+            target.AppendLine("        saved[l] = ctxs[l]->state[0];");
+            target.AppendLine("        well_conditioned &= circuit_step_coefficient(ctxs[l]) >= CIRCUIT_F32_MIN_STEP;");
+            target.AppendLine("    }");
+            target.AppendLine();
+            target.AppendLine("    if (well_conditioned) {");
+            target.AppendLine($"        circuit_process_x{lanes}_f32(ctxs, inputs, outputs, num_samples);");
+            target.AppendLine("        int finite = 1;");
+            target.AppendLine("        for (int l = 0; l < LANES; l++)");
+            target.AppendLine("            finite &= isfinite(ctxs[l]->state[0]) != 0;");
+            target.AppendLine("        if (finite) return;");
+            target.AppendLine("        for (int l = 0; l < LANES; l++)");
+            target.AppendLine("            ctxs[l]->state[0] = saved[l];");
+            target.AppendLine("    }");
+            target.AppendLine();
+            target.AppendLine("    for (int l = 0; l < LANES; l++)");
+            target.AppendLine("        circuit_process(ctxs[l], inputs[l], outputs[l], num_samples, 1);");
+            target.AppendLine("}");
+            target.AppendLine();
+        }
+
+        static void GenerateCleanupFunction(StringBuilder sb, bool polyphase, bool adaptive)
         {
             sb.AppendLine("void circuit_cleanup(CircuitContext* ctx) {");
             sb.AppendLine("    if (!ctx) return;");
             sb.AppendLine("    if (ctx->state) free(ctx->state);");
             sb.AppendLine("    if (ctx->parameters) free(ctx->parameters);");
+            if (polyphase)
+            {
+                sb.AppendLine("    free(ctx->up_history);");
+                sb.AppendLine("    free(ctx->down_history);");
+                sb.AppendLine("    free(ctx->oversampled_input);");
+                sb.AppendLine("    free(ctx->oversampled_output);");
+            }
+            if (adaptive)
+                sb.AppendLine("    free(ctx->saved_state);");
             sb.AppendLine("    free(ctx);");
             sb.AppendLine("}");
             sb.AppendLine();
         }
 
-        static void GenerateInfoFunction(StringBuilder sb)
+        // CIRCUIT_FORMAT_* flags of circuit_api.h
+        const int CircuitFormatF32Interleaved = 0x1;
+        const int CircuitFormatPlanar = 0x4;
+
+        // Bytes circuit_init allocates, as a constant C expression
+        static string MemoryFootprintExpression(bool polyphase, bool adaptive, int stateVars = NumStateVars)
+        {
+            int numParams = potentiometerNames.Count > 0 ? potentiometerNames.Count : 3;
+            int doubles = stateVars + numParams + (adaptive ? stateVars : 0);
+            string bytes = $"sizeof(CircuitContext) + sizeof(double) * {doubles}";
+            if (polyphase)
+                bytes += " + sizeof(double) * 2 * (CIRCUIT_PHASE_TAPS + CIRCUIT_FIR_LENGTH) + sizeof(float) * 2 * CIRCUIT_RESAMPLE_BLOCK * CIRCUIT_OVERSAMPLE";
+            return bytes;
+        }
+
+        // The version 2 fields let hosts compensate latency and size their pools without trial
+        // calls. circuit_process handles any number of samples and never allocates.
+        static void GenerateInfoFunction(StringBuilder sb, string name, string description, int oversample, string latency, string footprint, int formats)
         {
+            sb.AppendLine("#define CIRCUIT_INFO_VERSION 2");
+            sb.AppendLine();
             sb.AppendLine("typedef struct {");
             sb.AppendLine("    const char* name;");
             sb.AppendLine("    const char* description;");
@@ -487,22 +1049,83 @@ static void GenerateInfoFunction(StringBuilder sb)
             sb.AppendLine("    int num_outputs;");
             sb.AppendLine("    int recommended_oversample;");
             sb.AppendLine("    int recommended_iterations;");
+            sb.AppendLine("    int latency;");
+            sb.AppendLine("    int memory_footprint;");
+            sb.AppendLine("    int formats;");
+            sb.AppendLine("    int max_block_size;");
             sb.AppendLine("} CircuitInfo;");
             sb.AppendLine();
             sb.AppendLine("static CircuitInfo info = {");
-            sb.AppendLine($"    .name = \"{currentCircuit?.Name ?? "Exported Circuit"}\",");
-            sb.AppendLine("    .description = \"Circuit exported from LiveSPICE\",");
+            sb.AppendLine($"    .name = \"{name}\",");
+            sb.AppendLine($"    .description = \"{description}\",");
             sb.AppendLine("    .num_inputs = 1,");
             sb.AppendLine("    .num_outputs = 1,");
-            sb.AppendLine($"    .recommended_oversample = 8,");
-            sb.AppendLine("    .recommended_iterations = 8");
+            sb.AppendLine($"    .recommended_oversample = {oversample},");
+            sb.AppendLine("    .recommended_iterations = 8,");
+            sb.AppendLine($"    .latency = {latency},");
+            sb.AppendLine($"    .memory_footprint = (int)({footprint}),");
+            sb.AppendLine($"    .formats = 0x{formats:X},");
+            sb.AppendLine("    .max_block_size = 0");
             sb.AppendLine("};");
             sb.AppendLine();
             sb.AppendLine("const CircuitInfo* circuit_get_info(void) {");
             sb.AppendLine("    return &info;");
             sb.AppendLine("}");
+            sb.AppendLine();
+            sb.AppendLine("int circuit_get_info_version(void) {");
+            sb.AppendLine("    return CIRCUIT_INFO_VERSION;");
+            sb.AppendLine("}");
         }
         
+        // Same layout as CircuitApi in circuit_api.h. Hosts load the library with one lookup of
+        // circuit_get_api, which rejects hosts built for a newer ABI than this library.
+        static void GenerateApiFunction(StringBuilder sb, int lanes)
+        {
+            sb.AppendLine();
+            sb.AppendLine("#define CIRCUIT_ABI_VERSION 1");
+            sb.AppendLine();
+            sb.AppendLine("typedef void (*circuit_process_xN_t)(CircuitContext* const*, const float* const*, float* const*, int);");
+            sb.AppendLine();
+            sb.AppendLine("typedef struct {");
+            sb.AppendLine("    int abi_version;");
+            sb.AppendLine("    int size;");
+            sb.AppendLine("    CircuitContext* (*init)(int, int, int);");
+            sb.AppendLine("    void (*process)(CircuitContext*, const float*, float*, int, int);");
+            sb.AppendLine("    void (*set_parameter)(CircuitContext*, const char*, double);");
+            sb.AppendLine("    double (*get_parameter)(CircuitContext*, const char*);");
+            sb.AppendLine("    int (*get_num_parameters)(CircuitContext*);");
+            sb.AppendLine("    const char* (*get_parameter_name)(CircuitContext*, int);");
+            sb.AppendLine("    void (*cleanup)(CircuitContext*);");
+            sb.AppendLine("    int (*get_latency)(CircuitContext*);");
+            sb.AppendLine("    const CircuitInfo* (*get_info)(void);");
+            sb.AppendLine("    int (*get_info_version)(void);");
+            sb.AppendLine("    circuit_process_xN_t process_x4;");
+            sb.AppendLine("    circuit_process_xN_t process_x8;");
+            sb.AppendLine("} CircuitApi;");
+            sb.AppendLine();
+            sb.AppendLine("static const CircuitApi api = {");
+            sb.AppendLine("    .abi_version = CIRCUIT_ABI_VERSION,");
+            sb.AppendLine("    .size = sizeof(CircuitApi),");
+            sb.AppendLine("    .init = circuit_init,");
+            sb.AppendLine("    .process = circuit_process,");
+            sb.AppendLine("    .set_parameter = circuit_set_parameter,");
+            sb.AppendLine("    .get_parameter = circuit_get_parameter,");
+            sb.AppendLine("    .get_num_parameters = circuit_get_num_parameters,");
+            sb.AppendLine("    .get_parameter_name = circuit_get_parameter_name,");
+            sb.AppendLine("    .cleanup = circuit_cleanup,");
+            sb.AppendLine("    .get_latency = circuit_get_latency,");
+            sb.AppendLine("    .get_info = circuit_get_info,");
+            sb.AppendLine("    .get_info_version = circuit_get_info_version,");
+            sb.AppendLine(lanes == 4 ? "    .process_x4 = circuit_process_x4," : "    .process_x4 = NULL,");
+            sb.AppendLine(lanes == 8 ? "    .process_x8 = circuit_process_x8," : "    .process_x8 = NULL,");
+            sb.AppendLine("};");
+            sb.AppendLine();
+            sb.AppendLine("const CircuitApi* circuit_get_api(int version) {");
+            sb.AppendLine("    if (version < 1 || version > CIRCUIT_ABI_VERSION) return NULL;");
+            sb.AppendLine("    return &api;");
+            sb.AppendLine("}");
+        }
+
         static void GenerateParameterFunctions(StringBuilder sb)
         {
             // Parameter names array
@@ -541,15 +1164,16 @@ static void GenerateParameterFunctions(StringBuilder sb)
                 {
                     sb.AppendLine($"    if (strcmp(name, \"{potentiometerNames[i]}\") == 0) {{");
                     sb.AppendLine($"        ctx->parameters[{i}] = value;");
+                    sb.AppendLine("        circuit_update_coefficients(ctx);");
                     sb.AppendLine("        return;");
                     sb.AppendLine("    }");
                 }
             }
             else
             {
-                sb.AppendLine("    if (strcmp(name, \"Param1\") == 0) { ctx->parameters[0] = value; return; }");
-                sb.AppendLine("    if (strcmp(name, \"Param2\") == 0) { ctx->parameters[1] = value; return; }");
-                sb.AppendLine("    if (strcmp(name, \"Param3\") == 0) { ctx->parameters[2] = value; return; }");
+                sb.AppendLine("    if (strcmp(name, \"Param1\") == 0) { ctx->parameters[0] = value; circuit_update_coefficients(ctx); return; }");
+                sb.AppendLine("    if (strcmp(name, \"Param2\") == 0) { ctx->parameters[1] = value; circuit_update_coefficients(ctx); return; }");
+                sb.AppendLine("    if (strcmp(name, \"Param3\") == 0) { ctx->parameters[2] = value; circuit_update_coefficients(ctx); return; }");
             }
             sb.AppendLine("}");
             sb.AppendLine();
@@ -596,6 +1220,20 @@ static void CompileToDylib(string cFile)
             
             string dylibFile = Path.ChangeExtension(cFile, ".dylib");
             string command = $"clang -dynamiclib -o {dylibFile} {cFile} -O2 -lm";
+
+            // The library only depends on the source and the compiler flags
+            string cachedFile = null;
+            if (nativeCache != null)
+            {
+                string key = ContentHash(File.ReadAllText(cFile) + "\n" + command.Replace(dylibFile, "").Replace(cFile, ""));
+                cachedFile = Path.Combine(nativeCache, key + ".dylib");
+                if (File.Exists(cachedFile))
+                {
+                    File.Copy(cachedFile, dylibFile, true);
+                    Console.WriteLine($"Copied from cache: {dylibFile}");
+                    return;
+                }
+            }
             
             Console.WriteLine($"Running: {command}");
             
@@ -619,11 +1257,31 @@ static void CompileToDylib(string cFile)
             if (process.ExitCode == 0)
             {
                 Console.WriteLine($"Successfully created: {dylibFile}");
+                if (cachedFile != null)
+                {
+                    try
+                    {
+                        Directory.CreateDirectory(nativeCache);
+                        string temp = cachedFile + "." + Guid.NewGuid().ToString("N") + ".tmp";
+                        File.Copy(dylibFile, temp);
+                        File.Move(temp, cachedFile, true);
+                    }
+                    catch (IOException ex)
+                    {
+                        Console.WriteLine($"Warning: could not cache {dylibFile}: {ex.Message}");
+                    }
+                }
             }
             else
             {
                 Console.WriteLine($"Compilation failed: {error}");
             }
         }
+
+        static string ContentHash(string text)
+        {
+            using (var sha = System.Security.Cryptography.SHA256.Create())
+                return Convert.ToHexString(sha.ComputeHash(Encoding.UTF8.GetBytes(text))).ToLowerInvariant();
+        }
     }
 }
\ No newline at end of file
@@ -0,0 +1,156 @@
+/**
+ * Cost Report
+ * Static estimate of the cost of a circuit, from the size of its solution and the
+ * operations in the process function
+ */
+
+using System;
+using System.Collections.Generic;
+using System.Linq;
+using System.Text;
+using Circuit;
+using ComputerAlgebra;
+
+namespace LiveSPICEExport
+{
+    class CostReport
+    {
+        // Rough cycles per operation of a scalar x86-64/ARM64 core, for triage rather than prediction
+        const double AddCycles = 1.0;
+        const double MultiplyCycles = 1.0;
+        const double DivideCycles = 10.0;
+        const double TranscendentalCycles = 40.0;
+        const double CallCycles = 5.0;
+
+        public string Name;
+        public int SampleRate, Oversample, Iterations;
+        public List<Tuple<int, int>> NewtonSystems = new List<Tuple<int, int>>();  // M equations x N unknowns
+        public int KnownDeltas;
+        public int LinearAssignments;
+        public int StateSize;
+        public OperationCount Operations;  // Null if the process function could not be built
+
+        public static CostReport Of(Simulation simulation, string name, int sampleRate, int oversample)
+        {
+            var report = new CostReport()
+            {
+                Name = name,
+                SampleRate = sampleRate,
+                Oversample = oversample,
+                Iterations = simulation.Iterations,
+            };
+            foreach (SolutionSet i in simulation.Solution.Solutions)
+            {
+                if (i is LinearSolutions linear)
+                {
+                    report.LinearAssignments += linear.Solutions.Count();
+                }
+                else if (i is NewtonIteration newton)
+                {
+                    report.NewtonSystems.Add(Tuple.Create(newton.Equations.Count(), newton.UnknownDeltas.Count()));
+                    if (newton.KnownDeltas != null)
+                        report.KnownDeltas += newton.KnownDeltas.Count();
+                }
+            }
+            try
+            {
+                report.Operations = simulation.Operations;
+            }
+            catch (Exception ex)
+            {
+                Console.WriteLine($"Warning: could not count operations: {ex.Message}");
+            }
+            report.StateSize = simulation.StateSize;
+            return report;
+        }
+
+        // Multiply-adds and divisions of one Gaussian elimination and back substitution
+        static double EliminationCycles(int m, int n)
+        {
+            double fma = 0;
+            for (int k = 0; k < Math.Min(m, n); k++)
+                fma += (m - k - 1) * (n - k + 1);
+            fma += n * (n - 1) / 2;
+            return fma * (AddCycles + MultiplyCycles) + Math.Min(m, n) * DivideCycles;
+        }
+
+        // One oversampled step, with one Newton iteration
+        public double StepCycles
+        {
+            get
+            {
+                var ops = Operations;
+                if (ops == null)
+                    return NewtonSystems.Sum(i => EliminationCycles(i.Item1, i.Item2)) + LinearAssignments * 4 * (AddCycles + MultiplyCycles);
+                return ops.Add * AddCycles + ops.Multiply * MultiplyCycles + ops.Divide * DivideCycles
+                    + ops.Transcendental * TranscendentalCycles + (ops.Call - ops.Transcendental) * CallCycles;
+            }
+        }
+
+        // Each further Newton iteration re-evaluates the nonlinear models (the transcendental
+        // calls) and solves the systems again.
+        public double IterationCycles
+        {
+            get
+            {
+                double models = Operations != null ? Operations.Transcendental * TranscendentalCycles : 0;
+                return models + NewtonSystems.Sum(i => EliminationCycles(i.Item1, i.Item2));
+            }
+        }
+
+        public double CyclesPerSample(int iterations)
+        {
+            return Oversample * (StepCycles + Math.Max(iterations - 1, 0) * IterationCycles);
+        }
+
+        // One line for circuit_get_info
+        public string Summary
+        {
+            get
+            {
+                string newton = NewtonSystems.Count > 0
+                    ? $"{NewtonSystems.Count} Newton ({string.Join(", ", NewtonSystems.Select(i => $"{i.Item1}x{i.Item2}"))})"
+                    : "linear";
+                return $"{newton}, {LinearAssignments} linear, {StateSize} state, ~{CyclesPerSample(1):F0} cycles/sample";
+            }
+        }
+
+        public override string ToString()
+        {
+            var sb = new StringBuilder();
+            sb.AppendLine($"Circuit: {Name}");
+            sb.AppendLine($"Sample rate: {SampleRate} Hz, oversample {Oversample}, at most {Iterations} Newton iterations");
+            sb.AppendLine();
+            sb.AppendLine("Solution");
+            if (NewtonSystems.Count == 0)
+                sb.AppendLine("  Newton iterations: none, the circuit is linear");
+            for (int i = 0; i < NewtonSystems.Count; i++)
+                sb.AppendLine($"  Newton iteration {i + 1}: {NewtonSystems[i].Item1} x {NewtonSystems[i].Item2} (equations x unknowns)");
+            if (KnownDeltas > 0)
+                sb.AppendLine($"  Newton deltas solved ahead of time: {KnownDeltas}");
+            sb.AppendLine($"  Linear solution assignments: {LinearAssignments}");
+            sb.AppendLine($"  State vector: {StateSize} values");
+            sb.AppendLine();
+            sb.AppendLine("Operations per oversampled step (one Newton iteration)");
+            if (Operations != null)
+            {
+                sb.AppendLine($"  Add/subtract: {Operations.Add}");
+                sb.AppendLine($"  Multiply: {Operations.Multiply}");
+                sb.AppendLine($"  Divide: {Operations.Divide}");
+                sb.AppendLine($"  Transcendental: {Operations.Transcendental}");
+                sb.AppendLine($"  Other calls: {Operations.Call - Operations.Transcendental}");
+            }
+            else
+            {
+                sb.AppendLine("  Unavailable, estimated from the solution size");
+            }
+            sb.AppendLine();
+            sb.AppendLine($"Estimated cost (add/mul {AddCycles}, div {DivideCycles}, transcendental {TranscendentalCycles}, call {CallCycles} cycles)");
+            sb.AppendLine($"  Converging in 1 iteration: {CyclesPerSample(1):F0} cycles/sample");
+            if (NewtonSystems.Count > 0)
+                sb.AppendLine($"  Converging in {Iterations} iterations: {CyclesPerSample(Iterations):F0} cycles/sample");
+            sb.AppendLine($"  At 3 GHz, {SampleRate} Hz: {CyclesPerSample(1) * SampleRate / 3e9 * 100:F2}% of a core");
+            return sb.ToString();
+        }
+    }
+}
@@ -296,9 +296,10 @@ private void RebuildSolution()
                     try
                     {
                         ComputerAlgebra.Expression h = (ComputerAlgebra.Expression)1 / (stream.SampleRate * Oversample);
-                        TransientSolution solution = Circuit.TransientSolution.Solve(circuit.Analyze(), h, Log);
+                        // The controls are parameters of the solution, so moving them doesn't need a new solution.
+                        TransientSolution solution = SolutionCache.Global.Solve(circuit, h, true, Log);
 
-                        simulation = new Simulation(solution)
+                        Simulation s = new Simulation(solution)
                         {
                             Log = Log,
                             Input = inputs.Keys.ToArray(),
@@ -306,6 +307,14 @@ private void RebuildSolution()
                             Oversample = Oversample,
                             Iterations = Iterations,
                         };
+                        // Compile here, so the audio thread doesn't wait for it.
+                        s.Compile();
+                        lock (sync)
+                        {
+                            // The controls may have moved while the solution was built.
+                            s.UpdateParameters();
+                            simulation = s;
+                        }
                     }
                     catch (Exception Ex)
                     {
@@ -320,31 +329,41 @@ private void RebuildSolution()
         private TaskScheduler scheduler = new RedundantTaskScheduler(1);
         private void UpdateSimulation(bool Rebuild)
         {
+            // The potentiometers are parameters of the solution, the simulation reads their new values at the next block.
+            if (!Rebuild)
+            {
+                lock (sync)
+                    simulation?.UpdateParameters();
+                return;
+            }
+
             int id = Interlocked.Increment(ref update);
             new Task(() =>
             {
                 ComputerAlgebra.Expression h = (ComputerAlgebra.Expression)1 / (stream.SampleRate * Oversample);
-                TransientSolution s = Circuit.TransientSolution.Solve(circuit.Analyze(), h, Rebuild ? (ILog)Log : new NullLog());
+                TransientSolution s = SolutionCache.Global.Solve(circuit, h, true, Log);
+                Simulation rebuilt;
+                lock (sync)
+                {
+                    rebuilt = new Simulation(s)
+                    {
+                        Log = Log,
+                        Input = inputs.Keys.ToArray(),
+                        Output = probes.Select(i => i.V).Concat(OutputChannels.Select(i => i.Signal)).ToArray(),
+                        Oversample = Oversample,
+                        Iterations = Iterations,
+                    };
+                }
+                // Compile outside of the lock, so the audio thread doesn't wait for it.
+                rebuilt.Compile();
                 lock (sync)
                 {
                     if (id > clock)
                     {
-                        if (Rebuild)
-                        {
-                            simulation = new Simulation(s)
-                            {
-                                Log = Log,
-                                Input = inputs.Keys.ToArray(),
-                                Output = probes.Select(i => i.V).Concat(OutputChannels.Select(i => i.Signal)).ToArray(),
-                                Oversample = Oversample,
-                                Iterations = Iterations,
-                            };
-                        }
-                        else
-                        {
-                            simulation.Solution = s;
-                            clock = id;
-                        }
+                        // The controls may have moved while the solution was built.
+                        rebuilt.UpdateParameters();
+                        simulation = rebuilt;
+                        clock = id;
                     }
                 }
             }).Start(scheduler);
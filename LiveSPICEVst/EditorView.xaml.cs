@@ -48,6 +48,16 @@ public void UpdateSchematic()
                 }
             }
 
+            for (int i = 0; i < ResamplingComboBox.Items.Count; i++)
+            {
+                if ((ResamplingComboBox.Items[i] as ComboBoxItem).Content as string == Plugin.SimulationProcessor.Resampling.ToString())
+                {
+                    ResamplingComboBox.SelectedIndex = i;
+
+                    break;
+                }
+            }
+
             for (int i = 0; i < IterationsComboBox.Items.Count; i++)
             {
                 if (int.Parse((IterationsComboBox.Items[i] as ComboBoxItem).Content as string) == Plugin.SimulationProcessor.Iterations)
@@ -66,6 +76,13 @@ private void OversampleComboBox_SelectionChanged(object sender, SelectionChanged
             Plugin.SimulationProcessor.Oversample = int.Parse((combo.SelectedItem as ComboBoxItem).Content as string);
         }
 
+        private void ResamplingComboBox_SelectionChanged(object sender, SelectionChangedEventArgs e)
+        {
+            ComboBox combo = sender as ComboBox;
+
+            Plugin.SimulationProcessor.Resampling = (Circuit.Resampling)Enum.Parse(typeof(Circuit.Resampling), (combo.SelectedItem as ComboBoxItem).Content as string);
+        }
+
         private void IterationsComboBox_SelectionChanged(object sender, SelectionChangedEventArgs e)
         {
             ComboBox combo = sender as ComboBox;
@@ -16,19 +16,36 @@ namespace LiveSPICEVst
     /// <summary>
     /// Managed VST class to be loaded by SharpSoundDevice
     /// </summary>
-    public class LiveSPICEPlugin : AudioPluginWPF
+    public class LiveSPICEPlugin : AudioPluginWPF, IDisposable
     {
         public SimulationProcessor SimulationProcessor { get; private set; }
         new public EditorView EditorView { get; set; }
         public string SchematicPath { get { return SimulationProcessor.SchematicPath; } }
 
-        AudioIOPortManaged monoInput;
-        AudioIOPortManaged monoOutput;
+        EAudioChannelConfiguration channelConfiguration;
+        AudioIOPortManaged input;
+        AudioIOPortManaged output;
 
-        bool haveSimulationError = false;
+        volatile bool haveSimulationError = false;
+
+        // The host compensates for the delay of the plugin with the latency it reads from this
+        // property, in the versions of AudioPlugSharp that expose one.
+        static readonly PropertyInfo latencyProperty = typeof(AudioPluginWPF).GetProperties()
+            .FirstOrDefault(i => i.CanWrite && (i.Name == "LatencySamples" || i.Name == "Latency"));
+        int reportedLatency = 0;
 
         public LiveSPICEPlugin()
+            : this(EAudioChannelConfiguration.Mono)
+        {
+        }
+
+        /// <summary>
+        /// Create the plugin with the given channels. Each channel runs through its own instance of the circuit.
+        /// </summary>
+        protected LiveSPICEPlugin(EAudioChannelConfiguration channelConfiguration)
         {
+            this.channelConfiguration = channelConfiguration;
+
             Company = "";
             Website = "livespice.org";
             Contact = "";
@@ -46,14 +63,25 @@ public LiveSPICEPlugin()
             //GCSettings.LatencyMode = GCLatencyMode.LowLatency;
 
             SimulationProcessor = new SimulationProcessor();
+            SimulationProcessor.UpdateFailed += SimulationProcessor_UpdateFailed;
+        }
+
+        /// <summary>
+        /// Stop the simulation threads, once the host has stopped processing audio with the plugin
+        /// </summary>
+        public void Dispose()
+        {
+            SimulationProcessor.Dispose();
         }
 
         public override void Initialize()
         {
             base.Initialize();
 
-            InputPorts = new AudioIOPortManaged[] { monoInput = new AudioIOPortManaged("Mono Input", EAudioChannelConfiguration.Mono) };
-            OutputPorts = new AudioIOPortManaged[] { monoOutput = new AudioIOPortManaged("Mono Output", EAudioChannelConfiguration.Mono) };
+            string channels = channelConfiguration == EAudioChannelConfiguration.Stereo ? "Stereo" : "Mono";
+
+            InputPorts = new AudioIOPortManaged[] { input = new AudioIOPortManaged(channels + " Input", channelConfiguration) };
+            OutputPorts = new AudioIOPortManaged[] { output = new AudioIOPortManaged(channels + " Output", channelConfiguration) };
         }
 
         public override void InitializeProcessing()
@@ -83,6 +111,7 @@ public override byte[] SaveState()
             {
                 SchematicPath = SimulationProcessor.SchematicPath,
                 OverSample = SimulationProcessor.Oversample,
+                Resampling = SimulationProcessor.Resampling,
                 Iterations = SimulationProcessor.Iterations
             };
 
@@ -142,6 +171,7 @@ public override void RestoreState(byte[] stateData)
                     }
 
                     SimulationProcessor.Oversample = programParameters.OverSample;
+                    SimulationProcessor.Resampling = programParameters.Resampling;
                     SimulationProcessor.Iterations = programParameters.Iterations;
 
                     foreach (VSTProgramControlParameter controlParameter in programParameters.ControlParameters)
@@ -195,16 +225,18 @@ public override void Process()
         {
             if (haveSimulationError)
             {
-                monoInput.PassThroughTo(monoOutput);
+                input.PassThroughTo(output);
             }
             else
             {
-                double[][] inBuffers = monoInput.GetAudioBuffers();
-                double[][] outBuffers = monoOutput.GetAudioBuffers();
+                double[][] inBuffers = input.GetAudioBuffers();
+                double[][] outBuffers = output.GetAudioBuffers();
 
                 try
                 {
                     SimulationProcessor.RunSimulation(inBuffers, outBuffers, inBuffers[0].Length);
+
+                    ReportLatency();
                 }
                 catch (Exception ex)
                 {
@@ -217,5 +249,36 @@ public override void Process()
                 }
             }
         }
+
+        /// <summary>
+        /// Pass the audio through after the circuit fails to build. This runs on the updater thread, not the audio thread.
+        /// </summary>
+        void SimulationProcessor_UpdateFailed(Exception ex)
+        {
+            haveSimulationError = true;
+
+            new Thread(() =>
+            {
+                MessageBox.Show("Error building circuit simulation.\n\n" + ex.Message, "Simulation Error", MessageBoxButton.OK, MessageBoxImage.Error);
+            }).Start();
+        }
+
+        /// <summary>
+        /// Tell the host about a change in the latency of the running simulation, such as after turning polyphase resampling on
+        /// </summary>
+        void ReportLatency()
+        {
+            int latency = SimulationProcessor.Latency;
+
+            if (latency == reportedLatency)
+                return;
+
+            reportedLatency = latency;
+
+            if (latencyProperty != null)
+                latencyProperty.SetValue(this, Convert.ChangeType(latency, latencyProperty.PropertyType));
+            else
+                Logger.Log("Latency changed to " + latency + " samples, but the host can't be told about it");
+        }
     }
 }
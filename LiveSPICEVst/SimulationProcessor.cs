@@ -3,7 +3,6 @@
 using System.Collections.ObjectModel;
 using System.Linq;
 using System.Threading;
-using System.Threading.Tasks;
 using Circuit;
 using ComputerAlgebra;
 using Util;
@@ -13,12 +12,18 @@ namespace LiveSPICEVst
 {
 
     /// <summary>
-    /// Manages single-channel audio circuit simulation
+    /// Manages audio circuit simulation, with an instance of the circuit for each channel
     /// </summary>
-    public class SimulationProcessor
+    public class SimulationProcessor : IDisposable
     {
         public ObservableCollection<IComponentWrapper> InteractiveComponents { get; private set; }
 
+        /// <summary>
+        /// Raised on the updater thread when solving or building the circuit fails. The simulations that
+        /// are running are kept.
+        /// </summary>
+        public event Action<Exception> UpdateFailed;
+
         public Schematic Schematic { get; private set; }
         public string SchematicPath { get; private set; }
         public string SchematicName { get { return System.IO.Path.GetFileNameWithoutExtension(SchematicPath); } }
@@ -48,6 +53,52 @@ public int Oversample
                 {
                     oversample = value;
 
+                    // The updater thread solves and builds the simulations again, starting the circuit from rest
+                    needUpdate = true;
+                }
+            }
+        }
+
+        public Resampling Resampling
+        {
+            get { return resampling; }
+            set
+            {
+                if (resampling != value)
+                {
+                    resampling = value;
+
+                    // The updater thread solves and builds the simulations again, starting the circuit from rest
+                    needUpdate = true;
+                }
+            }
+        }
+
+        /// <summary>
+        /// Delay of the processed audio, in samples, of the simulations that are running.
+        /// </summary>
+        public int Latency
+        {
+            get
+            {
+                SimulationState current = state;
+                return current != null ? current.Simulations[0].Latency : 0;
+            }
+        }
+
+        /// <summary>
+        /// Number of audio channels. Each channel is processed by its own instance of the circuit,
+        /// and the instances run in parallel.
+        /// </summary>
+        public int Channels
+        {
+            get { return channels; }
+            set
+            {
+                if (channels != value)
+                {
+                    channels = value;
+
                     needRebuild = true;
                 }
             }
@@ -62,28 +113,92 @@ public int Iterations
                 {
                     iterations = value;
 
-                    needRebuild = true;
+                    // The updater thread solves and builds the simulations again, starting the circuit from rest
+                    needUpdate = true;
                 }
             }
         }
 
         double sampleRate;
         int oversample = 2;
+        Resampling resampling = Resampling.Linear;
         int iterations = 8;
+        int channels = 1;
 
         Circuit.Circuit circuit = null;
-        Simulation simulation = null;
         bool needUpdate = false;
         bool needRebuild = false;
         int updateSamplesElapsed = 0;
         int delayUpdateSamples = 0;
-        Exception simulationUpdateException = null;
+
+        /// <summary>
+        /// The compiled simulations of the channels. The updater thread builds a new state for every update,
+        /// and the audio thread, the only one to use the current state, replaces it at the start of a block,
+        /// so it never waits for a lock or changes a simulation's settings.
+        /// </summary>
+        class SimulationState
+        {
+            public Simulation[] Simulations;
+            // Buffers of each channel, in the form Simulation.Run takes them
+            public double[][][] ChannelInputs;
+            public double[][][] ChannelOutputs;
+            // Threads running the channels other than the first, null for one channel
+            public WorkerPool Workers;
+            // Whether the state that replaced this one runs on other workers, so no state uses these anymore
+            public bool DisposeWorkers;
+            // Next replaced state waiting for room in the retired queue
+            public SimulationState Next;
+        }
+
+        // Only used by the audio thread
+        SimulationState state = null;
+        SimulationState retiring = null;
+        int blockSamples = 0;
+        Action<int> runChannel;
+
+        // New states from the updater thread to the audio thread, and replaced states back to the updater thread to dispose
+        SpscQueue<SimulationState> updates = new SpscQueue<SimulationState>(16);
+        SpscQueue<SimulationState> retired = new SpscQueue<SimulationState>(16);
+
+        /// <summary>
+        /// Settings of an update, copied from the processor when the audio thread requests the update, so
+        /// the updater thread builds the simulations from settings taken at one moment.
+        /// </summary>
+        class UpdateRequest
+        {
+            public int Id;
+            public Circuit.Circuit Circuit;
+            public double SampleRate;
+            public int Channels;
+            public int Oversample;
+            public Resampling Resampling;
+            public int Iterations;
+        }
+
+        // Requests from the audio thread to the updater thread. The three requests are exchanged between the
+        // threads, so neither allocates or waits: the audio thread fills in its own and swaps it with the
+        // published one, and the updater thread swaps its own with the published one to read it.
+        UpdateRequest writing = new UpdateRequest();
+        UpdateRequest published = new UpdateRequest();
+        int update = 0;
+        AutoResetEvent updateRequested = new AutoResetEvent(false);
+        Thread updater;
+        volatile bool disposed = false;
 
         public SimulationProcessor()
         {
             InteractiveComponents = new ObservableCollection<IComponentWrapper>();
 
             SampleRate = 44100;
+
+            runChannel = i => state.Simulations[i].Run(blockSamples, state.ChannelInputs[i], state.ChannelOutputs[i]);
+
+            updater = new Thread(UpdaterMain)
+            {
+                Name = "LiveSPICE updater",
+                IsBackground = true,
+            };
+            updater.Start();
         }
 
         public void LoadSchematic(string path)
@@ -185,150 +300,307 @@ void SetCircuit(Circuit.Circuit circuit)
         /// <param name="numSamples">Number of samples to process</param>
         public void RunSimulation(double[][] audioInputs, double[][] audioOutputs, int numSamples)
         {
-            // Throw any exception generated by asynchronous simulation updates
-            if (simulationUpdateException != null)
-            {
-                Exception toThrow = simulationUpdateException;
+            // Switch to the simulations built since the last block
+            ApplyUpdates();
 
-                simulationUpdateException = null;
+            Channels = Math.Min(audioInputs.Length, audioOutputs.Length);
 
-                throw toThrow;
-            }
-
-            if (simulation == null)
+            if (state == null)
             {
                 if (needRebuild)
                 {
                     if (circuit != null)
                     {
-                        UpdateSimulation(needRebuild);
+                        RequestUpdate();
 
                         needRebuild = false;
                     }
                 }
             }
 
-            if ((circuit == null) || (simulation == null))
+            if ((circuit == null) || (state == null))
             {
-                audioInputs[0].CopyTo(audioOutputs[0], 0);
+                for (int i = 0; i < channels; i++)
+                    audioInputs[i].CopyTo(audioOutputs[i], 0);
             }
             else
             {
-                lock (sync)
+                bool parametersChanged = false;
+
+                foreach (var component in InteractiveComponents)
                 {
-                    foreach (var component in InteractiveComponents)
+                    if (component.NeedUpdate)
                     {
-                        if (component.NeedUpdate)
+                        // Potentiometers are parameters of the simulation, other changes need a new solution
+                        if (component is PotWrapper && state.Simulations[0].Parameters.Any())
+                        {
+                            parametersChanged = true;
+                        }
+                        else
                         {
                             needUpdate = true;
 
-                            component.NeedUpdate = false;
-
                             updateSamplesElapsed = 0;
                         }
 
-                        if (component.NeedRebuild)
-                        {
-                            needRebuild = true;
+                        component.NeedUpdate = false;
+                    }
 
-                            component.NeedRebuild = false;
-                        }
+                    if (component.NeedRebuild)
+                    {
+                        needRebuild = true;
+
+                        component.NeedRebuild = false;
                     }
+                }
 
-                    if (needUpdate || needRebuild)
+                if (needUpdate || needRebuild)
+                {
+                    // Delay updates until user input settles
+                    if (needRebuild || (updateSamplesElapsed > delayUpdateSamples))
                     {
-                        // Delay updates until user input settles
-                        if (needRebuild || (updateSamplesElapsed > delayUpdateSamples))
-                        {
-                            UpdateSimulation(needRebuild);
+                        RequestUpdate();
 
-                            needRebuild = false;
-                            needUpdate = false;
-                        }
-                        else
-                        {
-                            updateSamplesElapsed += numSamples;
-                        }
+                        needRebuild = false;
+                        needUpdate = false;
+                    }
+                    else
+                    {
+                        updateSamplesElapsed += numSamples;
                     }
+                }
 
-                    simulation.Run(numSamples, audioInputs, audioOutputs);
+                if (parametersChanged)
+                {
+                    foreach (Simulation simulation in state.Simulations)
+                        simulation.UpdateParameters();
                 }
+
+                RunChannels(audioInputs, audioOutputs, numSamples);
             }
         }
 
-        int clock = -1;
-        int update = 0;
-        TaskScheduler scheduler = new RedundantTaskScheduler(1);
-        object sync = new object();
+        /// <summary>
+        /// Run each channel through its own simulation, the first on the calling thread and the others on the workers
+        /// </summary>
+        void RunChannels(double[][] audioInputs, double[][] audioOutputs, int numSamples)
+        {
+            // Channels added since the last rebuild pass through until the simulations are rebuilt
+            int count = Math.Min(state.Simulations.Length, channels);
+            for (int i = count; i < channels; i++)
+                audioInputs[i].CopyTo(audioOutputs[i], 0);
+
+            for (int i = 0; i < count; i++)
+            {
+                state.ChannelInputs[i][0] = audioInputs[i];
+                state.ChannelOutputs[i][0] = audioOutputs[i];
+            }
+            blockSamples = numSamples;
+
+            if (state.Workers != null && count > 1)
+            {
+                state.Workers.Run(count, runChannel);
+            }
+            else
+            {
+                for (int i = 0; i < count; i++)
+                    runChannel(i);
+            }
+        }
 
         /// <summary>
-        /// Update the simulation asynchronously
+        /// Switch to the newest state built by the updater thread, on the audio thread, and hand the replaced
+        /// states back to the updater thread to dispose.
         /// </summary>
-        /// <param name="rebuild">Whether a full simulation rebuild is required</param>
-        void UpdateSimulation(bool rebuild)
+        void ApplyUpdates()
         {
-            int id = Interlocked.Increment(ref update);
-            new Task(() =>
+            SimulationState newState;
+            bool applied = false;
+            while (updates.TryDequeue(out newState))
             {
-                try
+                applied = true;
+
+                if (state != null)
                 {
-                    Analysis analysis = circuit.Analyze();
-                    TransientSolution ts = TransientSolution.Solve(analysis, (Real)1 / (sampleRate * oversample));
+                    // States are applied in the order they were built, and a replaced pool is never used again
+                    state.DisposeWorkers = state.Workers != newState.Workers;
+                    state.Next = retiring;
+                    retiring = state;
+                }
+                state = newState;
+            }
 
-                    lock (sync)
-                    {
-                        if (id > clock)
-                        {
-                            if (rebuild)
-                            {
-                                Expression inputExpression = circuit.Components.OfType<Input>().Select(i => i.In).SingleOrDefault();
-
-                                if (inputExpression == null)
-                                {
-                                    simulationUpdateException = new NotSupportedException("Circuit has no inputs.");
-                                }
-                                else
-                                {
-                                    IEnumerable<Speaker> speakers = circuit.Components.OfType<Speaker>();
-
-                                    Expression outputExpression = 0;
-
-                                    // Output is voltage drop across the speakers
-                                    foreach (Speaker speaker in speakers)
-                                    {
-                                        outputExpression += speaker.Out;
-                                    }
-
-                                    if (outputExpression.EqualsZero())
-                                    {
-                                        simulationUpdateException = new NotSupportedException("Circuit has no speaker outputs.");
-                                    }
-                                    else
-                                    {
-                                        simulation = new Simulation(ts)
-                                        {
-                                            Oversample = oversample,
-                                            Iterations = iterations,
-                                            Input = new[] { inputExpression },
-                                            Output = new[] { outputExpression }
-                                        };
-                                    }
-                                }
-                            }
-                            else
-                            {
-                                simulation.Solution = ts;
-                                clock = id;
-                            }
-                        }
-                    }
+            // The new simulations took the parameter values when they were built, and the controls may have moved since
+            if (applied)
+            {
+                foreach (Simulation simulation in state.Simulations)
+                    simulation.UpdateParameters();
+            }
+
+            // States the queue has no room for wait for the next block
+            bool handedBack = false;
+            while (retiring != null)
+            {
+                SimulationState next = retiring.Next;
+                if (!retired.TryEnqueue(retiring))
+                    break;
+                retiring = next;
+                handedBack = true;
+            }
+            if (handedBack)
+                updateRequested.Set();
+        }
+
+        /// <summary>
+        /// Ask the updater thread to solve the circuit and build new simulations
+        /// </summary>
+        void RequestUpdate()
+        {
+            UpdateRequest request = writing;
+            request.Id = ++update;
+            request.Circuit = circuit;
+            request.SampleRate = sampleRate;
+            request.Channels = channels;
+            request.Oversample = oversample;
+            request.Resampling = resampling;
+            request.Iterations = iterations;
+
+            writing = Interlocked.Exchange(ref published, request);
+            updateRequested.Set();
+        }
+
+        // Only used by the updater thread: the workers of the last state it built, and the last request it read
+        WorkerPool workers = null;
+        UpdateRequest reading = new UpdateRequest();
+
+        /// <summary>
+        /// Solve the circuit and build simulations off the audio thread. Requests that arrive while
+        /// an update is in progress are merged into one update.
+        /// </summary>
+        void UpdaterMain()
+        {
+            int done = 0;
+            while (!disposed)
+            {
+                updateRequested.WaitOne();
+                if (disposed)
+                    break;
+
+                SimulationState old;
+                while (retired.TryDequeue(out old))
+                {
+                    // The state that replaced this one may still be running on the same workers
+                    if (old.DisposeWorkers && old.Workers != null)
+                        old.Workers.Dispose();
+                }
+
+                // Without a new request, this reads back the request already done
+                reading = Interlocked.Exchange(ref published, reading);
+                if (reading.Id <= done)
+                    continue;
+                done = reading.Id;
+                if (reading.Circuit == null)
+                    continue;
+
+                SimulationState result;
+                try
+                {
+                    result = Build(reading);
                 }
                 catch (Exception ex)
                 {
-                    simulationUpdateException = ex;
+                    UpdateFailed?.Invoke(ex);
+                    continue;
                 }
 
-            }).Start(scheduler);
+                // The audio thread empties the queue every block
+                while (!updates.TryEnqueue(result) && !disposed)
+                    Thread.Sleep(1);
+            }
+        }
+
+        /// <summary>
+        /// Solve the circuit, and build and compile the simulations of each channel
+        /// </summary>
+        SimulationState Build(UpdateRequest request)
+        {
+            Circuit.Circuit circuit = request.Circuit;
+
+            // The controls are parameters of the solution, so moving them doesn't need a new solution
+            TransientSolution solution = SolutionCache.Global.Solve(circuit, (Real)1 / (request.SampleRate * request.Oversample), true, new NullLog());
+
+            Expression inputExpression = circuit.Components.OfType<Input>().Select(i => i.In).SingleOrDefault();
+
+            if (inputExpression == null)
+                throw new NotSupportedException("Circuit has no inputs.");
+
+            IEnumerable<Speaker> speakers = circuit.Components.OfType<Speaker>();
+
+            Expression outputExpression = 0;
+
+            // Output is voltage drop across the speakers
+            foreach (Speaker speaker in speakers)
+            {
+                outputExpression += speaker.Out;
+            }
+
+            if (outputExpression.EqualsZero())
+                throw new NotSupportedException("Circuit has no speaker outputs.");
+
+            Simulation[] simulations = Enumerable.Range(0, request.Channels).Select(i => new Simulation(solution)
+            {
+                Oversample = request.Oversample,
+                Resampling = request.Resampling,
+                Iterations = request.Iterations,
+                Input = new[] { inputExpression },
+                Output = new[] { outputExpression }
+            }).ToArray();
+
+            // Compile here, so the first block doesn't compile on the audio thread
+            foreach (Simulation simulation in simulations)
+                simulation.Compile();
+
+            // One thread per simulation, up to the number of cores
+            int concurrency = Math.Min(simulations.Length, Environment.ProcessorCount);
+            if (concurrency != (workers != null ? workers.Concurrency : 1))
+                workers = concurrency > 1 ? new WorkerPool(concurrency - 1) : null;
+
+            return new SimulationState()
+            {
+                Simulations = simulations,
+                ChannelInputs = simulations.Select(i => new double[1][]).ToArray(),
+                ChannelOutputs = simulations.Select(i => new double[1][]).ToArray(),
+                Workers = workers,
+            };
+        }
+
+        /// <summary>
+        /// Stop the updater thread and the workers. Only call this once the audio thread has stopped calling RunSimulation.
+        /// </summary>
+        public void Dispose()
+        {
+            disposed = true;
+            updateRequested.Set();
+            updater.Join();
+
+            // Neither thread uses the states anymore, including the ones still in the queues
+            HashSet<WorkerPool> pools = new HashSet<WorkerPool>() { workers };
+            SimulationState old;
+            while (updates.TryDequeue(out old))
+                pools.Add(old.Workers);
+            while (retired.TryDequeue(out old))
+                pools.Add(old.Workers);
+            for (old = retiring; old != null; old = old.Next)
+                pools.Add(old.Workers);
+            if (state != null)
+                pools.Add(state.Workers);
+
+            foreach (WorkerPool pool in pools)
+                pool?.Dispose();
+
+            state = null;
+            retiring = null;
+            workers = null;
         }
     }
 }
@@ -9,12 +9,14 @@ public class VstProgramParameters
     {
         public string SchematicPath { get; set; }
         public int OverSample { get; set; }
+        public Circuit.Resampling Resampling { get; set; }
         public int Iterations { get; set; }
         public List<VSTProgramControlParameter> ControlParameters { get; set; }
 
         public VstProgramParameters()
         {
             OverSample = 2;
+            Resampling = Circuit.Resampling.Linear;
             Iterations = 8;
 
             ControlParameters = new List<VSTProgramControlParameter>();
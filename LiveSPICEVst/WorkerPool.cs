@@ -0,0 +1,173 @@
+﻿using System;
+using System.Diagnostics;
+using System.Runtime.ExceptionServices;
+using System.Threading;
+
+namespace LiveSPICEVst
+{
+    /// <summary>
+    /// Fixed pool of threads to run the independent jobs of an audio block in parallel with the
+    /// audio thread. A worker that finishes its jobs spins briefly for the next request, which
+    /// catches the jobs of a block handed out in quick succession, then blocks until the next
+    /// block arrives. The OS decides which cores the workers run on.
+    /// </summary>
+    public class WorkerPool : IDisposable
+    {
+        // How long a worker spins for the next block before blocking. This is well under the
+        // length of a block (1.3 ms for 64 samples at 48 kHz), so an idle worker doesn't take a
+        // core away from the host for most of the block.
+        private static readonly long IdleTicks = Stopwatch.Frequency / 10000;
+
+        private class Worker
+        {
+            public Thread Thread;
+            // Index of the thread in RunJobs.
+            public int Index;
+            public SemaphoreSlim Wake = new SemaphoreSlim(0);
+            // 1 while the worker is blocked (or about to block) on Wake.
+            public int Sleeping = 0;
+            // Blocks handed to and completed by this worker.
+            public int Requested = 0;
+            public int Done = 0;
+            public ExceptionDispatchInfo Exception;
+        }
+
+        private Worker[] workers;
+        private volatile bool disposed = false;
+
+        // The block being processed.
+        private Action<int> job;
+        private int count;
+
+        /// <summary>
+        /// Number of jobs that run at the same time, including the calling thread.
+        /// </summary>
+        public int Concurrency { get { return workers.Length + 1; } }
+
+        /// <summary>
+        /// Create a pool of Workers threads.
+        /// </summary>
+        /// <param name="Workers">Number of worker threads, in addition to the thread calling Run.</param>
+        public WorkerPool(int Workers)
+        {
+            workers = new Worker[Workers];
+            for (int i = 0; i < Workers; ++i)
+            {
+                Worker w = workers[i] = new Worker() { Index = i + 1 };
+                w.Thread = new Thread(() => WorkerMain(w))
+                {
+                    Name = "LiveSPICE worker " + i,
+                    IsBackground = true,
+                    Priority = ThreadPriority.Highest,
+                };
+                w.Thread.Start();
+            }
+        }
+
+        /// <summary>
+        /// Run Job(0) ... Job(Count - 1), and return when they are all complete. Job i runs on the
+        /// calling thread if i is a multiple of Concurrency, and on worker i % Concurrency - 1
+        /// otherwise. Once all of the jobs are complete, the first exception thrown by a job (on the
+        /// calling thread, then by worker) is rethrown here.
+        /// </summary>
+        public void Run(int Count, Action<int> Job)
+        {
+            job = Job;
+            count = Count;
+
+            int busy = Math.Min(Count - 1, workers.Length);
+            for (int i = 0; i < busy; ++i)
+            {
+                Worker w = workers[i];
+                // Interlocked operations are full fences, so the job is visible before the request.
+                Interlocked.Increment(ref w.Requested);
+                if (Interlocked.Exchange(ref w.Sleeping, 0) == 1)
+                    w.Wake.Release();
+            }
+
+            ExceptionDispatchInfo exception = null;
+            try
+            {
+                RunJobs(0);
+            }
+            catch (Exception ex)
+            {
+                exception = ExceptionDispatchInfo.Capture(ex);
+            }
+
+            // Wait for every worker before throwing, so none of them is still running a job of this
+            // block when the caller handles the exception or starts the next block.
+            for (int i = 0; i < busy; ++i)
+            {
+                Worker w = workers[i];
+                SpinWait spin = new SpinWait();
+                while (Volatile.Read(ref w.Done) != Volatile.Read(ref w.Requested))
+                    spin.SpinOnce(-1);
+
+                if (exception == null)
+                    exception = w.Exception;
+                w.Exception = null;
+            }
+            if (exception != null)
+                exception.Throw();
+        }
+
+        // Run the jobs of the thread with the given index, 0 for the calling thread.
+        private void RunJobs(int Index)
+        {
+            for (int i = Index; i < count; i += workers.Length + 1)
+                job(i);
+        }
+
+        private void WorkerMain(Worker w)
+        {
+            int seen = 0;
+            while (!disposed)
+            {
+                // Spin for the next block, then block on Wake if it takes too long.
+                long idle = Stopwatch.GetTimestamp();
+                SpinWait spin = new SpinWait();
+                while (Volatile.Read(ref w.Requested) == seen && !disposed)
+                {
+                    if (Stopwatch.GetTimestamp() - idle < IdleTicks)
+                    {
+                        spin.SpinOnce(-1);
+                    }
+                    else
+                    {
+                        Interlocked.Exchange(ref w.Sleeping, 1);
+                        // If a block arrived before the flag was set, take the flag back. If Run
+                        // already took it, Wake was released and must be consumed.
+                        if (Volatile.Read(ref w.Requested) == seen && !disposed || Interlocked.Exchange(ref w.Sleeping, 0) == 0)
+                            w.Wake.Wait();
+                        idle = Stopwatch.GetTimestamp();
+                    }
+                }
+                if (disposed)
+                    break;
+
+                seen = Volatile.Read(ref w.Requested);
+                try
+                {
+                    RunJobs(w.Index);
+                }
+                catch (Exception ex)
+                {
+                    w.Exception = ExceptionDispatchInfo.Capture(ex);
+                }
+                Volatile.Write(ref w.Done, seen);
+            }
+        }
+
+        public void Dispose()
+        {
+            disposed = true;
+            foreach (Worker w in workers)
+            {
+                if (Interlocked.Exchange(ref w.Sleeping, 0) == 1)
+                    w.Wake.Release();
+                w.Thread.Join();
+            }
+        }
+    }
+}
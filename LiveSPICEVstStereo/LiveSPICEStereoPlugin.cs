@@ -0,0 +1,22 @@
+﻿using AudioPlugSharp;
+using LiveSPICEVst;
+
+namespace LiveSPICEVstStereo
+{
+    /// <summary>
+    /// Stereo version of the LiveSPICE plugin. It is a separate plugin, so sessions using the mono plugin are
+    /// unchanged. Each channel runs through its own instance of the circuit, in parallel, so it needs about
+    /// twice the CPU of the mono plugin.
+    /// </summary>
+    public class LiveSPICEStereoPlugin : LiveSPICEPlugin
+    {
+        public LiveSPICEStereoPlugin()
+            : base(EAudioChannelConfiguration.Stereo)
+        {
+            PluginName = "LiveSPICEVst Stereo";
+
+            // Unique 64bit ID for the plugin
+            PluginID = 0x8ED51696A7BCCFC1;
+        }
+    }
+}
@@ -19,25 +19,26 @@ static async Task<int> Main(string[] args)
                                                     .WithOption<bool>(new[] { "--plot" }, "Plot results")
                                                     .WithOption<bool>(new[] { "--stats" }, "Write statistics")
                                                     .WithOption(new[] { "--samples" }, () => 4800, "Samples")
-                                                    .WithHandler(CommandHandler.Create<string, bool, bool, int, int, int, int>(Test)))
+                                                    .WithHandler(CommandHandler.Create<string, bool, bool, int, int, int, int, double>(Test)))
                                                .WithCommand("benchmark", "Run benchmarks", c => c
                                                     .WithArgument<string>("pattern", "Glob pattern for files to benchmark")
-                                                    .WithHandler(CommandHandler.Create<string, int, int, int>(Benchmark)))
+                                                    .WithHandler(CommandHandler.Create<string, int, int, int, double>(Benchmark)))
                                                .WithGlobalOption(new Option<int>("--sampleRate", () => 48000, "Sample Rate"))
                                                .WithGlobalOption(new Option<int>("--oversample", () => 8, "Oversample"))
-                                               .WithGlobalOption(new Option<int>("--iterations", () => 8, "Iterations"));
+                                               .WithGlobalOption(new Option<int>("--iterations", () => 8, "Iterations"))
+                                               .WithGlobalOption(new Option<double>("--approximationError", () => 0.0, "Largest relative error allowed in exp/log/pow, 0 for exact"));
 
             return await rootCommand.InvokeAsync(args);
         }
 
-        public static void Test(string pattern, bool plot, bool stats, int sampleRate, int samples, int oversample, int iterations)
+        public static void Test(string pattern, bool plot, bool stats, int sampleRate, int samples, int oversample, int iterations, double approximationError)
         {
             var log = new ConsoleLog() { Verbosity = MessageType.Info };
             var tester = new Test();
 
             foreach (var circuit in GetCircuits(pattern, log))
             {
-                var outputs = tester.Run(circuit, t => Harmonics(t, 0.5, 82, 2), sampleRate, samples, oversample, iterations);
+                var outputs = tester.Run(circuit, t => Harmonics(t, 0.5, 82, 2), sampleRate, samples, oversample, iterations, ApproximationError: approximationError);
                 if (plot)
                 {
                     tester.PlotAll(circuit.Name, outputs);
@@ -49,7 +50,7 @@ public static void Test(string pattern, bool plot, bool stats, int sampleRate, i
             }
         }
 
-        public static void Benchmark(string pattern, int sampleRate, int oversample, int iterations)
+        public static void Benchmark(string pattern, int sampleRate, int oversample, int iterations, double approximationError)
         {
             var log = new ConsoleLog() { Verbosity = MessageType.Error };
             var tester = new Test();
@@ -57,7 +58,7 @@ public static void Benchmark(string pattern, int sampleRate, int oversample, int
             System.Console.WriteLine(fmt, "Circuit", "Analysis (ms)", "Solve (ms)", "Sim (kHz)", "Realtime x");
             foreach (var circuit in GetCircuits(pattern, log))
             {
-                double[] result = tester.Benchmark(circuit, t => Harmonics(t, 0.5, 82, 2), sampleRate, oversample, iterations, log: log);
+                double[] result = tester.Benchmark(circuit, t => Harmonics(t, 0.5, 82, 2), sampleRate, oversample, iterations, log: log, ApproximationError: approximationError);
                 double analyzeTime = result[0];
                 double solveTime = result[1];
                 double simRate = result[2];
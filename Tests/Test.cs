@@ -42,7 +42,8 @@ private static Expression FindInput(Circuit.Circuit C)
             int Oversample,
             int Iterations,
             Expression? Input = null,
-            IEnumerable<Expression>? Outputs = null)
+            IEnumerable<Expression>? Outputs = null,
+            double ApproximationError = 0.0)
         {
             Analysis analysis = C.Analyze();
             TransientSolution TS = TransientSolution.Solve(analysis, (Real)1 / (SampleRate * Oversample));
@@ -64,6 +65,7 @@ private static Expression FindInput(Circuit.Circuit C)
             {
                 Oversample = Oversample,
                 Iterations = Iterations,
+                ApproximationError = ApproximationError,
                 Input = new[] { Input },
                 Output = Outputs,
             };
@@ -108,7 +110,8 @@ private static Expression FindInput(Circuit.Circuit C)
             int Iterations,
             Expression? Input = null,
             IEnumerable<Expression>? Outputs = null,
-            ILog? log = null)
+            ILog? log = null,
+            double ApproximationError = 0.0)
         {
             Analysis? analysis = null;
             double analyzeTime = Benchmark(1, () => analysis = C.Analyze());
@@ -133,6 +136,7 @@ private static Expression FindInput(Circuit.Circuit C)
             {
                 Oversample = Oversample,
                 Iterations = Iterations,
+                ApproximationError = ApproximationError,
                 Input = new[] { Input },
                 Output = Outputs,
             };
@@ -104,6 +104,33 @@ public class NullLog : ILog
         void ILog.WriteLines(MessageType Type, IEnumerable<string> Lines) { }
     }
 
+    /// <summary>
+    /// Log implementation that holds the messages until they are written to another log, e.g. to
+    /// keep the messages of work done in parallel in order.
+    /// </summary>
+    public class BufferedLog : ILog
+    {
+        private List<Tuple<MessageType, string>> messages = new List<Tuple<MessageType, string>>();
+
+        void ILog.WriteLine(MessageType Type, string Text, params object[] Format) { messages.Add(Tuple.Create(Type, String.Format(Text, Format))); }
+        void ILog.WriteLines(MessageType Type, IEnumerable<string> Lines)
+        {
+            foreach (string i in Lines)
+                messages.Add(Tuple.Create(Type, i));
+        }
+
+        /// <summary>
+        /// Write the messages to Log and clear them.
+        /// </summary>
+        public void WriteTo(ILog Log)
+        {
+            // The buffered text is already formatted.
+            foreach (Tuple<MessageType, string> i in messages)
+                Log.WriteLines(i.Item1, new[] { i.Item2 });
+            messages.Clear();
+        }
+    }
+
     /// <summary>
     /// Log implementation targeting a StringBuilder.
     /// </summary>
@@ -0,0 +1,56 @@
+﻿using System.Threading;
+
+namespace Util
+{
+    /// <summary>
+    /// Bounded queue between one producer thread and one consumer thread, without locks. Neither
+    /// side waits for the other: TryEnqueue fails when the queue is full, and TryDequeue when it
+    /// is empty.
+    /// </summary>
+    public class SpscQueue<T>
+    {
+        // One slot is always empty, to tell a full queue from an empty one.
+        private readonly T[] items;
+        // Next item to read, only written by the consumer.
+        private int head = 0;
+        // Next item to write, only written by the producer.
+        private int tail = 0;
+
+        public SpscQueue(int Capacity) { items = new T[Capacity + 1]; }
+
+        /// <summary>
+        /// Add an item to the queue. Only called by the producer.
+        /// </summary>
+        /// <returns>false if the queue is full.</returns>
+        public bool TryEnqueue(T Item)
+        {
+            int t = tail;
+            int next = (t + 1) % items.Length;
+            if (next == Volatile.Read(ref head))
+                return false;
+            items[t] = Item;
+            // Publish the item after it is written.
+            Volatile.Write(ref tail, next);
+            return true;
+        }
+
+        /// <summary>
+        /// Take the oldest item from the queue. Only called by the consumer.
+        /// </summary>
+        /// <returns>false if the queue is empty.</returns>
+        public bool TryDequeue(out T Item)
+        {
+            int h = head;
+            if (h == Volatile.Read(ref tail))
+            {
+                Item = default(T);
+                return false;
+            }
+            Item = items[h];
+            items[h] = default(T);
+            // Release the slot after it is read.
+            Volatile.Write(ref head, (h + 1) % items.Length);
+            return true;
+        }
+    }
+}
@@ -50,6 +50,24 @@ typedef void (*circuit_process_t)(CircuitContext* ctx,
                                    int num_samples,
                                    int num_channels);
 
+/**
+ * Process N independent circuit instances in lockstep (optional)
+ *
+ * Exported as circuit_process_x4 / circuit_process_x8 when the circuit was
+ * generated with ExportToC --lanes. Each instance is mono and keeps its own
+ * context, parameters and state; the instances are laid out as SIMD lanes.
+ * Contexts with differing oversample or sample rate are processed one at a time.
+ *
+ * @param ctxs Array of N circuit contexts
+ * @param inputs Array of N mono input buffers
+ * @param outputs Array of N mono output buffers
+ * @param num_samples Number of samples to process per instance
+ */
+typedef void (*circuit_process_xN_t)(CircuitContext* const* ctxs,
+                                      const float* const* inputs,
+                                      float* const* outputs,
+                                      int num_samples);
+
 /**
  * Set a circuit parameter (e.g., potentiometer position)
  * 
@@ -89,20 +107,102 @@ typedef const char* (*circuit_get_parameter_name_t)(CircuitContext* ctx, int ind
  */
 typedef void (*circuit_cleanup_t)(CircuitContext* ctx);
 
+/**
+ * Get the delay of the output relative to the input (optional)
+ *
+ * Non-zero when the circuit was generated with ExportToC --resampling polyphase;
+ * hosts use it for latency compensation.
+ *
+ * @param ctx Circuit context
+ * @return Latency in samples at the host sample rate
+ */
+typedef int (*circuit_get_latency_t)(CircuitContext* ctx);
+
+/**
+ * Sample formats accepted by the processing functions (CircuitInfo.formats)
+ */
+#define CIRCUIT_FORMAT_F32_INTERLEAVED 0x1  // float, channels interleaved (circuit_process)
+#define CIRCUIT_FORMAT_F64             0x2  // double samples
+#define CIRCUIT_FORMAT_PLANAR          0x4  // One buffer per instance (circuit_process_xN)
+
+/**
+ * Version of CircuitInfo described by this header
+ */
+#define CIRCUIT_INFO_VERSION 2
+
 /**
  * Get circuit information
+ *
+ * Fields are only ever appended. A host reads the fields of the version the
+ * library reports through circuit_get_info_version, and only the version 1
+ * fields when the library does not export it.
  */
 typedef struct {
+    // Version 1
     const char* name;
     const char* description;
     int num_inputs;
     int num_outputs;
     int recommended_oversample;
     int recommended_iterations;
+
+    // Version 2
+    int latency;                // Samples at the host rate, as circuit_get_latency
+    int memory_footprint;       // Bytes allocated by circuit_init for one context
+    int formats;                // CIRCUIT_FORMAT_* flags
+    int max_block_size;         // Largest num_samples per call, 0 if unlimited
 } CircuitInfo;
 
 typedef const CircuitInfo* (*circuit_get_info_t)(void);
 
+/**
+ * Get the version of the CircuitInfo returned by circuit_get_info (optional)
+ *
+ * @return CIRCUIT_INFO_VERSION the library was generated with, 1 if not exported
+ */
+typedef int (*circuit_get_info_version_t)(void);
+
+/**
+ * Version of CircuitApi described by this header
+ */
+#define CIRCUIT_ABI_VERSION 1
+
+/**
+ * All entry points of a circuit library, returned by circuit_get_api
+ *
+ * Entry points are only ever appended, and increment CIRCUIT_ABI_VERSION. The
+ * optional ones are NULL when the library was generated without them.
+ */
+typedef struct {
+    int abi_version;            // CIRCUIT_ABI_VERSION of the library
+    int size;                   // sizeof(CircuitApi) in the library
+
+    // Version 1
+    circuit_init_t init;
+    circuit_process_t process;
+    circuit_set_parameter_t set_parameter;
+    circuit_get_parameter_t get_parameter;
+    circuit_get_num_parameters_t get_num_parameters;
+    circuit_get_parameter_name_t get_parameter_name;
+    circuit_cleanup_t cleanup;
+    circuit_get_latency_t get_latency;
+    circuit_get_info_t get_info;
+    circuit_get_info_version_t get_info_version;
+    circuit_process_xN_t process_x4;     // Optional
+    circuit_process_xN_t process_x8;     // Optional
+} CircuitApi;
+
+/**
+ * Get the function table of a circuit library
+ *
+ * Loading a circuit takes one symbol lookup. Libraries that do not export it
+ * predate the function table and are loaded symbol by symbol.
+ *
+ * @param version CIRCUIT_ABI_VERSION the host was built with
+ * @return Function table, or NULL if the library is older than version
+ */
+typedef const CircuitApi* (*circuit_get_api_t)(int version);
+
 #ifdef __cplusplus
 }
 #endif
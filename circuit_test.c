@@ -41,6 +41,8 @@ circuit_get_num_parameters_t circuit_get_num_parameters = NULL;
 circuit_get_parameter_name_t circuit_get_parameter_name = NULL;
 circuit_cleanup_t circuit_cleanup = NULL;
 circuit_get_info_t circuit_get_info = NULL;
+circuit_get_latency_t circuit_get_latency = NULL;
+circuit_get_info_version_t circuit_get_info_version = NULL;
 
 void print_usage(const char* program) {
     printf("Usage: %s [options]\n\n", program);
@@ -142,15 +144,38 @@ int load_circuit(const char* circuit_file) {
         return -1;
     }
     
-    // Load function pointers
-    circuit_init = (circuit_init_t)dlsym(handle, "circuit_init");
-    circuit_process = (circuit_process_t)dlsym(handle, "circuit_process");
-    circuit_set_parameter = (circuit_set_parameter_t)dlsym(handle, "circuit_set_parameter");
-    circuit_get_parameter = (circuit_get_parameter_t)dlsym(handle, "circuit_get_parameter");
-    circuit_get_num_parameters = (circuit_get_num_parameters_t)dlsym(handle, "circuit_get_num_parameters");
-    circuit_get_parameter_name = (circuit_get_parameter_name_t)dlsym(handle, "circuit_get_parameter_name");
-    circuit_cleanup = (circuit_cleanup_t)dlsym(handle, "circuit_cleanup");
-    circuit_get_info = (circuit_get_info_t)dlsym(handle, "circuit_get_info");
+    // Load function pointers, from the function table when the library has one
+    circuit_get_api_t circuit_get_api = (circuit_get_api_t)dlsym(handle, "circuit_get_api");
+    if (circuit_get_api) {
+        const CircuitApi* api = circuit_get_api(CIRCUIT_ABI_VERSION);
+        if (!api || api->abi_version < CIRCUIT_ABI_VERSION || api->size < (int)sizeof(CircuitApi)) {
+            fprintf(stderr, "Error: Circuit ABI version %d, expected %d\n",
+                    api ? api->abi_version : 0, CIRCUIT_ABI_VERSION);
+            return -1;
+        }
+        circuit_init = api->init;
+        circuit_process = api->process;
+        circuit_set_parameter = api->set_parameter;
+        circuit_get_parameter = api->get_parameter;
+        circuit_get_num_parameters = api->get_num_parameters;
+        circuit_get_parameter_name = api->get_parameter_name;
+        circuit_cleanup = api->cleanup;
+        circuit_get_info = api->get_info;
+        circuit_get_latency = api->get_latency;
+        circuit_get_info_version = api->get_info_version;
+    } else {
+        // Exported before circuit_get_api
+        circuit_init = (circuit_init_t)dlsym(handle, "circuit_init");
+        circuit_process = (circuit_process_t)dlsym(handle, "circuit_process");
+        circuit_set_parameter = (circuit_set_parameter_t)dlsym(handle, "circuit_set_parameter");
+        circuit_get_parameter = (circuit_get_parameter_t)dlsym(handle, "circuit_get_parameter");
+        circuit_get_num_parameters = (circuit_get_num_parameters_t)dlsym(handle, "circuit_get_num_parameters");
+        circuit_get_parameter_name = (circuit_get_parameter_name_t)dlsym(handle, "circuit_get_parameter_name");
+        circuit_cleanup = (circuit_cleanup_t)dlsym(handle, "circuit_cleanup");
+        circuit_get_info = (circuit_get_info_t)dlsym(handle, "circuit_get_info");
+        circuit_get_latency = (circuit_get_latency_t)dlsym(handle, "circuit_get_latency");
+        circuit_get_info_version = (circuit_get_info_version_t)dlsym(handle, "circuit_get_info_version");
+    }
     
     // Check required functions
     if (!circuit_init || !circuit_process || !circuit_cleanup) {
@@ -208,7 +233,18 @@ int process_audio(TestConfig* config) {
         printf("\nCircuit: %s\n", info->name);
         printf("  Description: %s\n", info->description);
         printf("  Inputs: %d, Outputs: %d\n", info->num_inputs, info->num_outputs);
+        if (circuit_get_info_version && circuit_get_info_version() >= 2) {
+            printf("  Memory: %d bytes per context\n", info->memory_footprint);
+            printf("  Formats:%s%s%s\n",
+                   info->formats & CIRCUIT_FORMAT_F32_INTERLEAVED ? " f32" : "",
+                   info->formats & CIRCUIT_FORMAT_F64 ? " f64" : "",
+                   info->formats & CIRCUIT_FORMAT_PLANAR ? " planar" : "");
+            if (info->max_block_size > 0)
+                printf("  Max block size: %d\n", info->max_block_size);
+        }
     }
+    if (circuit_get_latency)
+        printf("  Latency: %d samples\n", circuit_get_latency(ctx));
     
     // Set parameters
     if (config->num_params > 0 && circuit_set_parameter) {